@@ -29,10 +29,18 @@
 
 #include "sn-backend.h"
 #include "sn-item.h"
+#include "sn-util.h"
 #include "sn-watcher.h"
 
 
 
+/* same approach as in Plasma Workspace: wait until the item calms down */
+#define UPDATE_DELAY   (10 * G_TIME_SPAN_MILLISECOND)
+/* items which are due within this window are updated in the same wakeup */
+#define UPDATE_WINDOW  (5 * G_TIME_SPAN_MILLISECOND)
+
+
+
 static void                  sn_backend_finalize                     (GObject                 *object);
 
 static void                  sn_backend_watcher_bus_acquired         (GDBusConnection         *connection,
@@ -89,6 +97,9 @@ static void                  sn_backend_host_remove_item             (SnBackend
 
 static void                  sn_backend_host_clear_items             (SnBackend               *backend);
 
+static void                  sn_backend_update_schedule              (SnBackend               *backend,
+                                                                      gint64                   deadline);
+
 
 
 struct _SnBackendClass
@@ -108,6 +119,12 @@ struct _SnBackend
   SnWatcher           *host_proxy;
   GHashTable          *host_items;
   GCancellable        *host_cancellable;
+
+  /* pending item updates, the earliest deadline first */
+  SnDeadlineQueue      update_items;
+  guint                update_timeout;
+  guint                update_wakeups;
+  guint                update_count;
 };
 
 G_DEFINE_TYPE (SnBackend, sn_backend, G_TYPE_OBJECT)
@@ -192,6 +209,11 @@ sn_backend_init (SnBackend *backend)
   backend->host_proxy = NULL;
   backend->host_items = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
   backend->host_cancellable = g_cancellable_new ();
+
+  sn_deadline_queue_init (&backend->update_items);
+  backend->update_timeout = 0;
+  backend->update_wakeups = 0;
+  backend->update_count = 0;
 }
 
 
@@ -201,6 +223,8 @@ sn_backend_finalize (GObject *object)
 {
   SnBackend *backend = XFCE_SN_BACKEND (object);
 
+  g_debug ("Item updates: %u in %u wakeups", backend->update_count, backend->update_wakeups);
+
   g_object_unref (backend->host_cancellable);
 
   sn_backend_host_clear_items (backend);
@@ -208,6 +232,10 @@ sn_backend_finalize (GObject *object)
   g_hash_table_destroy (backend->host_items);
   g_hash_table_destroy (backend->watcher_items);
 
+  if (backend->update_timeout != 0)
+    g_source_remove (backend->update_timeout);
+  sn_deadline_queue_clear (&backend->update_items);
+
   if (backend->host_proxy != NULL)
     g_object_unref (backend->host_proxy);
 
@@ -617,6 +645,73 @@ sn_backend_host_item_finish (SnItem    *item,
 
 
 
+static gboolean
+sn_backend_update_timeout (gpointer user_data)
+{
+  SnBackend *backend = user_data;
+  gint64     now, next;
+  gpointer   item;
+  GList     *due = NULL, *li;
+  guint      count = 0;
+
+  backend->update_timeout = 0;
+  now = g_get_monotonic_time ();
+
+  /* only the items due within the window are visited */
+  while ((item = sn_deadline_queue_pop (&backend->update_items, now + UPDATE_WINDOW)) != NULL)
+    due = g_list_prepend (due, item);
+
+  due = g_list_reverse (due);
+  for (li = due; li != NULL; li = li->next)
+    {
+      sn_item_update (li->data);
+      count++;
+    }
+  g_list_free (due);
+
+  backend->update_wakeups++;
+  backend->update_count += count;
+
+  next = sn_deadline_queue_next (&backend->update_items);
+  if (next != G_MAXINT64)
+    sn_backend_update_schedule (backend, next);
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
+static void
+sn_backend_update_schedule (SnBackend *backend,
+                            gint64     deadline)
+{
+  gint64 delay;
+
+  /* deadlines only grow, so the armed timer is never later than a new one */
+  if (backend->update_timeout == 0)
+    {
+      delay = MAX (deadline - g_get_monotonic_time (), 0);
+      backend->update_timeout =
+        g_timeout_add ((guint) ((delay + G_TIME_SPAN_MILLISECOND - 1) / G_TIME_SPAN_MILLISECOND),
+                       sn_backend_update_timeout, backend);
+    }
+}
+
+
+
+static void
+sn_backend_host_item_invalidate (SnItem    *item,
+                                 SnBackend *backend)
+{
+  gint64 deadline;
+
+  deadline = g_get_monotonic_time () + UPDATE_DELAY;
+  sn_deadline_queue_set (&backend->update_items, item, deadline);
+  sn_backend_update_schedule (backend, deadline);
+}
+
+
+
 static void
 sn_backend_host_item_registered (SnWatcher   *host_proxy,
                                  const gchar *service,
@@ -744,6 +839,8 @@ sn_backend_host_add_item (SnBackend   *backend,
                         G_CALLBACK (sn_backend_host_item_seal), backend);
       g_signal_connect (item, "finish",
                         G_CALLBACK (sn_backend_host_item_finish), backend);
+      g_signal_connect (item, "invalidate",
+                        G_CALLBACK (sn_backend_host_item_invalidate), backend);
       sn_item_start (item);
       g_hash_table_insert (backend->host_items, g_strdup (service), item);
     }
@@ -767,6 +864,8 @@ sn_backend_host_remove_item (SnBackend *backend,
   if (exposed)
     g_signal_emit (G_OBJECT (backend), sn_backend_signals[ITEM_REMOVED], 0, item);
 
+  sn_deadline_queue_remove (&backend->update_items, item);
+
   if (remove_from_table)
     g_hash_table_remove (backend->host_items, key);
 
@@ -42,6 +42,9 @@ static void                  sn_box_collect_known_items              (SnBox
 static void                  sn_box_list_changed                     (SnBox                   *box,
                                                                       SnConfig                *config);
 
+static void                  sn_box_configuration_changed            (SnBox                   *box,
+                                                                      SnConfig                *config);
+
 static void                  sn_box_add                              (GtkContainer            *container,
                                                                       GtkWidget               *child);
 
@@ -81,6 +84,22 @@ struct _SnBox
 
   /* in theory it's possible to have multiple items with same name */
   GHashTable          *children;
+
+  /* item -> button, removing an item doesn't depend on the known items */
+  GHashTable          *buttons;
+
+  /* all children and the shown ones in the order of known items,
+   * rebuilt only when children or the items list change */
+  GPtrArray           *ordered;
+  GPtrArray           *visible;
+  gboolean             order_valid;
+
+  /* sizes of the shown children and their positions computed from them */
+  GArray              *requisitions;
+  GArray              *layout;
+  gint                 layout_length;
+  gboolean             layout_horizontal;
+  gboolean             layout_valid;
 };
 
 G_DEFINE_TYPE (SnBox, sn_box, GTK_TYPE_CONTAINER)
@@ -119,6 +138,17 @@ sn_box_init (SnBox *box)
   gtk_container_set_border_width (GTK_CONTAINER (box), 0);
 
   box->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  box->buttons = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  box->ordered = g_ptr_array_new ();
+  box->visible = g_ptr_array_new ();
+  box->order_valid = FALSE;
+
+  box->requisitions = g_array_new (FALSE, TRUE, sizeof (GtkRequisition));
+  box->layout = g_array_new (FALSE, TRUE, sizeof (GtkAllocation));
+  box->layout_length = 0;
+  box->layout_horizontal = FALSE;
+  box->layout_valid = FALSE;
 }
 
 
@@ -129,6 +159,11 @@ sn_box_finalize (GObject *object)
   SnBox *box = XFCE_SN_BOX (object);
 
   g_hash_table_destroy (box->children);
+  g_hash_table_destroy (box->buttons);
+  g_ptr_array_free (box->ordered, TRUE);
+  g_ptr_array_free (box->visible, TRUE);
+  g_array_free (box->requisitions, TRUE);
+  g_array_free (box->layout, TRUE);
 
   G_OBJECT_CLASS (sn_box_parent_class)->finalize (object);
 }
@@ -146,6 +181,8 @@ sn_box_new (SnConfig *config)
                                   G_CALLBACK (sn_box_collect_known_items), box);
   sn_signal_connect_weak_swapped (G_OBJECT (box->config), "items-list-changed",
                                   G_CALLBACK (sn_box_list_changed), box);
+  sn_signal_connect_weak_swapped (G_OBJECT (box->config), "configuration-changed",
+                                  G_CALLBACK (sn_box_configuration_changed), box);
 
   return GTK_WIDGET (box);
 }
@@ -177,25 +214,17 @@ sn_box_collect_known_items (SnBox      *box,
 
 
 static void
-sn_box_widget_unmap (GtkWidget *widget,
-                     gpointer   data)
-{
-  gtk_widget_unmap (widget);
-}
-
-
-
-static void
-sn_box_list_changed (SnBox    *box,
-                     SnConfig *config)
+sn_box_update_order (SnBox *box)
 {
   SnButton *button;
   GList    *known_items, *li, *li_int, *li_tmp;
 
-  g_return_if_fail (XFCE_IS_SN_BOX (box));
-  g_return_if_fail (XFCE_IS_SN_CONFIG (config));
+  if (box->order_valid)
+    return;
 
-  gtk_container_foreach (GTK_CONTAINER (box), sn_box_widget_unmap, NULL);
+  g_ptr_array_set_size (box->ordered, 0);
+  g_ptr_array_set_size (box->visible, 0);
+  box->layout_valid = FALSE;
 
   known_items = sn_config_get_known_items (box->config);
   for (li = known_items; li != NULL; li = li->next)
@@ -204,14 +233,57 @@ sn_box_list_changed (SnBox    *box,
       for (li_tmp = li_int; li_tmp != NULL; li_tmp = li_tmp->next)
         {
           button = li_tmp->data;
+          g_ptr_array_add (box->ordered, button);
+
           if (!sn_config_is_hidden (box->config,
                                     sn_button_get_name (button)))
             {
-              gtk_widget_map (GTK_WIDGET (button));
+              g_ptr_array_add (box->visible, button);
             }
         }
     }
 
+  box->order_valid = TRUE;
+}
+
+
+
+static void
+sn_box_configuration_changed (SnBox    *box,
+                              SnConfig *config)
+{
+  /* sizes and rows might be different now */
+  box->layout_valid = FALSE;
+}
+
+
+
+static void
+sn_box_widget_unmap (GtkWidget *widget,
+                     gpointer   data)
+{
+  gtk_widget_unmap (widget);
+}
+
+
+
+static void
+sn_box_list_changed (SnBox    *box,
+                     SnConfig *config)
+{
+  guint i;
+
+  g_return_if_fail (XFCE_IS_SN_BOX (box));
+  g_return_if_fail (XFCE_IS_SN_CONFIG (config));
+
+  gtk_container_foreach (GTK_CONTAINER (box), sn_box_widget_unmap, NULL);
+
+  box->order_valid = FALSE;
+  sn_box_update_order (box);
+
+  for (i = 0; i < box->visible->len; i++)
+    gtk_widget_map (GTK_WIDGET (g_ptr_array_index (box->visible, i)));
+
   gtk_widget_queue_resize (GTK_WIDGET (box));
 }
 
@@ -234,6 +306,9 @@ sn_box_add (GtkContainer *container,
   li = g_hash_table_lookup (box->children, name);
   li = g_list_prepend (li, button);
   g_hash_table_replace (box->children, g_strdup (name), li);
+  g_hash_table_insert (box->buttons, sn_button_get_item (button), button);
+
+  box->order_valid = FALSE;
 
   gtk_widget_set_parent (child, GTK_WIDGET (box));
 
@@ -260,6 +335,13 @@ sn_box_remove (GtkContainer *container,
       /* unparent widget */
       li = g_list_remove_link (li, li_tmp);
       g_hash_table_replace (box->children, g_strdup (name), li);
+      g_hash_table_remove (box->buttons, sn_button_get_item (button));
+
+      /* keep the order, forall may be running over the array */
+      g_ptr_array_remove (box->ordered, button);
+      if (g_ptr_array_remove (box->visible, button))
+        box->layout_valid = FALSE;
+
       gtk_widget_unparent (child);
 
       /* resize, so we update has-hidden */
@@ -277,18 +359,18 @@ sn_box_forall (GtkContainer *container,
 {
   SnBox    *box = XFCE_SN_BOX (container);
   SnButton *button;
-  GList    *known_items, *li, *li_int, *li_tmp;
+  guint     i;
 
-  /* run callback for all children */
-  known_items = sn_config_get_known_items (box->config);
-  for (li = known_items; li != NULL; li = li->next)
+  sn_box_update_order (box);
+
+  /* run callback for all children, the current one might be removed by it */
+  for (i = 0; i < box->ordered->len;)
     {
-      li_int = g_hash_table_lookup (box->children, li->data);
-      for (li_tmp = li_int; li_tmp != NULL; li_tmp = li_tmp->next)
-        {
-          button = li_tmp->data;
-          callback (GTK_WIDGET (button), callback_data);
-        }
+      button = g_ptr_array_index (box->ordered, i);
+      callback (GTK_WIDGET (button), callback_data);
+
+      if (i < box->ordered->len && g_ptr_array_index (box->ordered, i) == button)
+        i++;
     }
 }
 
@@ -303,22 +385,15 @@ sn_box_child_type (GtkContainer *container)
 
 
 static void
-sn_box_measure_and_allocate (GtkWidget *widget,
-                             gint      *minimum_length,
-                             gint      *natural_length,
-                             gboolean   allocate,
-                             gint       x0,
-                             gint       y0,
-                             gboolean   horizontal)
+sn_box_compute_layout (SnBox    *box,
+                       gboolean  horizontal)
 {
-  SnBox          *box = XFCE_SN_BOX (widget);
-  SnButton       *button;
-  GList          *known_items, *li, *li_int, *li_tmp;
+  GtkRequisition *child_req;
+  GtkAllocation  *child_alloc;
   gint            panel_size, config_nrows, icon_size, hx_size, hy_size, nrows;
   gboolean        single_row, single_horizontal, square_icons, rect_child;
   gint            total_length, column_length, item_length, row;
-  GtkRequisition  child_req;
-  GtkAllocation   child_alloc;
+  guint           i;
 
   panel_size = sn_config_get_panel_size (box->config);
   config_nrows = sn_config_get_nrows (box->config);
@@ -343,87 +418,139 @@ sn_box_measure_and_allocate (GtkWidget *widget,
   item_length = 0;
   row = 0;
 
-  known_items = sn_config_get_known_items (box->config);
-  for (li = known_items; li != NULL; li = li->next)
+  g_array_set_size (box->layout, box->visible->len);
+
+  for (i = 0; i < box->visible->len; i++)
     {
-      li_int = g_hash_table_lookup (box->children, li->data);
-      for (li_tmp = li_int; li_tmp != NULL; li_tmp = li_tmp->next)
-        {
-          button = li_tmp->data;
-          if (sn_config_is_hidden (box->config,
-                                   sn_button_get_name (button)))
-            {
-              continue;
-            }
+      child_req = &g_array_index (box->requisitions, GtkRequisition, i);
+      child_alloc = &g_array_index (box->layout, GtkAllocation, i);
 
-          gtk_widget_get_preferred_size (GTK_WIDGET (button), NULL, &child_req);
+      rect_child = child_req->width > child_req->height;
+      if (horizontal)
+        {
+          if (square_icons && (!rect_child || (config_nrows >= 2 && !single_row)))
+            item_length = hx_size;
+          else
+            item_length = MAX (hx_size, child_req->width);
 
-          rect_child = child_req.width > child_req.height;
-          if (horizontal)
-            {
-              if (square_icons && (!rect_child || (config_nrows >= 2 && !single_row)))
-                item_length = hx_size;
-              else
-                item_length = MAX (hx_size, child_req.width);
+          column_length = MAX (column_length, item_length);
+          single_horizontal = FALSE;
+        }
+      else
+        {
+          column_length = hx_size;
+          single_horizontal = rect_child;
 
-              column_length = MAX (column_length, item_length);
-              single_horizontal = FALSE;
-            }
+          if (square_icons)
+            item_length = single_horizontal ? panel_size : hy_size;
           else
-            {
-              column_length = hx_size;
-              single_horizontal = rect_child;
+            item_length = MAX (MIN (panel_size, child_req->width), hy_size);
+        }
 
-              if (square_icons)
-                item_length = single_horizontal ? panel_size : hy_size;
-              else
-                item_length = MAX (MIN (panel_size, child_req.width), hy_size);
-            }
+      if (single_horizontal)
+        {
+          if (row > 0)
+            total_length += hx_size;
+          row = -1; /* will become 0 later and take the full length */
+        }
 
-          if (single_horizontal)
-            {
-              if (row > 0)
-                total_length += hx_size;
-              row = -1; /* will become 0 later and take the full length */
-            }
+      /* positions are relative to the box, allocation only moves them */
+      if (horizontal)
+        {
+          child_alloc->x = total_length;
+          child_alloc->y = row * hy_size;
+          child_alloc->width = item_length;
+          child_alloc->height = hy_size;
+        }
+      else
+        {
+          child_alloc->x = single_horizontal ? 0 : row * hy_size;
+          child_alloc->y = total_length;
+          child_alloc->width = item_length;
+          child_alloc->height = hx_size;
+        }
 
-          if (allocate)
-            {
-              if (horizontal)
-                {
-                  child_alloc.x = x0 + total_length;
-                  child_alloc.y = y0 + row * hy_size;
-                  child_alloc.width = item_length;
-                  child_alloc.height = hy_size;
-                }
-              else
-                {
-                  child_alloc.x = x0 + (single_horizontal ? 0 : row * hy_size);
-                  child_alloc.y = y0 + total_length;
-                  child_alloc.width = item_length;
-                  child_alloc.height = hx_size;
-                }
-
-              gtk_widget_size_allocate (GTK_WIDGET (button), &child_alloc);
-            }
+      row = (row + 1) % nrows;
 
-          row = (row + 1) % nrows;
+      if (row == 0)
+        {
+          total_length += column_length;
+          column_length = 0;
+        }
+    }
+
+  total_length += column_length;
+
+  box->layout_length = total_length;
+  box->layout_horizontal = horizontal;
+  box->layout_valid = TRUE;
+}
 
-          if (row == 0)
+
+
+static void
+sn_box_measure_and_allocate (GtkWidget *widget,
+                             gint      *minimum_length,
+                             gint      *natural_length,
+                             gboolean   allocate,
+                             gint       x0,
+                             gint       y0,
+                             gboolean   horizontal)
+{
+  SnBox          *box = XFCE_SN_BOX (widget);
+  GtkRequisition  child_req;
+  GtkRequisition *cached_req;
+  GtkAllocation   child_alloc;
+  gboolean        changed;
+  guint           i;
+
+  sn_box_update_order (box);
+
+  changed = !box->layout_valid || box->layout_horizontal != horizontal;
+
+  /* children are measured again unless allocating right after a measure,
+   * the layout is only recomputed when one of their sizes has changed */
+  if (changed || !allocate)
+    {
+      if (box->requisitions->len != box->visible->len)
+        {
+          g_array_set_size (box->requisitions, box->visible->len);
+          changed = TRUE;
+        }
+
+      for (i = 0; i < box->visible->len; i++)
+        {
+          gtk_widget_get_preferred_size (GTK_WIDGET (g_ptr_array_index (box->visible, i)),
+                                         NULL, &child_req);
+
+          cached_req = &g_array_index (box->requisitions, GtkRequisition, i);
+          if (cached_req->width != child_req.width || cached_req->height != child_req.height)
             {
-              total_length += column_length;
-              column_length = 0;
+              *cached_req = child_req;
+              changed = TRUE;
             }
         }
+
+      if (changed)
+        sn_box_compute_layout (box, horizontal);
     }
 
-  total_length += column_length;
+  if (allocate)
+    {
+      for (i = 0; i < box->visible->len; i++)
+        {
+          child_alloc = g_array_index (box->layout, GtkAllocation, i);
+          child_alloc.x += x0;
+          child_alloc.y += y0;
+          gtk_widget_size_allocate (GTK_WIDGET (g_ptr_array_index (box->visible, i)), &child_alloc);
+        }
+    }
 
   if (minimum_length != NULL)
-    *minimum_length = total_length;
+    *minimum_length = box->layout_length;
 
   if (natural_length != NULL)
-    *natural_length = total_length;
+    *natural_length = box->layout_length;
 }
 
 
@@ -499,22 +626,10 @@ sn_box_remove_item (SnBox  *box,
                     SnItem *item)
 {
   SnButton *button;
-  GList    *known_items, *li, *li_int, *li_tmp;
 
   g_return_if_fail (XFCE_IS_SN_BOX (box));
 
-  known_items = sn_config_get_known_items (box->config);
-  for (li = known_items; li != NULL; li = li->next)
-    {
-      li_int = g_hash_table_lookup (box->children, li->data);
-      for (li_tmp = li_int; li_tmp != NULL; li_tmp = li_tmp->next)
-        {
-          button = li_tmp->data;
-          if (sn_button_get_item (button) == item)
-            {
-              gtk_container_remove (GTK_CONTAINER (box), GTK_WIDGET (button));
-              return;
-            }
-        }
-    }
+  button = g_hash_table_lookup (box->buttons, item);
+  if (button != NULL)
+    gtk_container_remove (GTK_CONTAINER (box), GTK_WIDGET (button));
 }
@@ -32,7 +32,7 @@
 
 
 
-static void                  sn_button_finalize                      (GObject                 *object);
+static void                  sn_button_dispose                       (GObject                 *object);
 
 static gboolean              sn_button_button_press                  (GtkWidget               *widget,
                                                                       GdkEventButton          *event);
@@ -43,9 +43,20 @@ static gboolean              sn_button_button_release                (GtkWidget
 static gboolean              sn_button_scroll_event                  (GtkWidget               *widget,
                                                                       GdkEventScroll          *event);
 
+static gboolean              sn_button_enter_notify                  (GtkWidget               *widget,
+                                                                      GdkEventCrossing        *event);
+
+static void                  sn_button_menu_attach                   (SnButton                *button);
+
+static void                  sn_button_menu_detach                   (SnButton                *button);
+
 static void                  sn_button_menu_changed                  (GtkWidget               *widget,
                                                                       SnItem                  *item);
 
+static void                  sn_button_state_changed                 (GtkWidget               *widget,
+                                                                      SnItemState             *state,
+                                                                      guint                    changes);
+
 static gboolean              sn_button_query_tooltip                 (GtkWidget               *widget,
                                                                       gint                     x,
                                                                       gint                     y,
@@ -78,6 +89,9 @@ struct _SnButton
   guint                menu_deactivate_handler;
   guint                menu_size_allocate_handler;
   guint                menu_size_allocate_idle_handler;
+
+  SnScrollQueue        scroll_queue;
+  guint                scroll_tick_handler;
 };
 
 G_DEFINE_TYPE (SnButton, sn_button, GTK_TYPE_BUTTON)
@@ -91,12 +105,13 @@ sn_button_class_init (SnButtonClass *klass)
   GtkWidgetClass *widget_class;
 
   object_class = G_OBJECT_CLASS (klass);
-  object_class->finalize = sn_button_finalize;
+  object_class->dispose = sn_button_dispose;
 
   widget_class = GTK_WIDGET_CLASS (klass);
   widget_class->button_press_event = sn_button_button_press;
   widget_class->button_release_event = sn_button_button_release;
   widget_class->scroll_event = sn_button_scroll_event;
+  widget_class->enter_notify_event = sn_button_enter_notify;
 }
 
 
@@ -137,6 +152,9 @@ sn_button_init (SnButton *button)
   button->menu_size_allocate_handler = 0;
   button->menu_size_allocate_idle_handler = 0;
 
+  sn_scroll_queue_init (&button->scroll_queue);
+  button->scroll_tick_handler = 0;
+
   gtk_widget_set_halign (GTK_WIDGET (button), GTK_ALIGN_FILL);
   gtk_widget_set_valign (GTK_WIDGET (button), GTK_ALIGN_FILL);
 }
@@ -187,10 +205,8 @@ sn_button_new (SnItem              *item,
   g_object_set (G_OBJECT (button), "has-tooltip", TRUE, NULL);
   g_signal_connect (button, "query-tooltip",
                     G_CALLBACK (sn_button_query_tooltip), NULL);
-  sn_signal_connect_weak_swapped (item, "tooltip-changed",
-                                  G_CALLBACK (gtk_widget_trigger_tooltip_query), button);
-  sn_signal_connect_weak_swapped (item, "menu-changed",
-                                  G_CALLBACK (sn_button_menu_changed), button);
+  sn_signal_connect_weak_swapped (item, "state-changed",
+                                  G_CALLBACK (sn_button_state_changed), button);
   sn_button_menu_changed (GTK_WIDGET (button), item);
 
   return GTK_WIDGET (button);
@@ -199,20 +215,14 @@ sn_button_new (SnItem              *item,
 
 
 static void
-sn_button_finalize (GObject *object)
+sn_button_dispose (GObject *object)
 {
   SnButton *button = XFCE_SN_BUTTON (object);
 
-  if (button->menu_deactivate_handler != 0)
-    g_signal_handler_disconnect (button->menu, button->menu_deactivate_handler);
-
-  if (button->menu_size_allocate_handler != 0)
-    g_signal_handler_disconnect (button->menu, button->menu_size_allocate_handler);
-
-  if (button->menu_size_allocate_idle_handler != 0)
-    g_source_remove (button->menu_size_allocate_idle_handler);
+  /* cached menu outlives the button, its detacher must not be called later */
+  sn_button_menu_detach (button);
 
-  G_OBJECT_CLASS (sn_button_parent_class)->finalize (object);
+  G_OBJECT_CLASS (sn_button_parent_class)->dispose (object);
 }
 
 
@@ -257,6 +267,9 @@ sn_button_button_press (GtkWidget      *widget,
 
   if ((event->button == 1 && (button->menu_only || menu_is_primary)) || event->button == 3)
     {
+      /* the menu might have been evicted from cache since the last popup */
+      sn_button_menu_attach (button);
+
       if (button->menu != NULL && sn_container_has_children (button->menu))
         {
           button->menu_deactivate_handler = 
@@ -291,12 +304,41 @@ sn_button_button_press (GtkWidget      *widget,
 
 
 
+static gint64
+sn_button_event_time (GdkEvent *event)
+{
+  guint32 event_time;
+  guint32 age;
+  gint64  now;
+
+  event_time = gdk_event_get_time (event);
+  if (event_time == GDK_CURRENT_TIME)
+    return 0;
+
+  /* X servers and wayland compositors stamp events with the monotonic
+   * clock in milliseconds, the difference is taken modulo 2^32 */
+  now = g_get_monotonic_time ();
+  age = (guint32) (now / 1000) - event_time;
+
+  /* the clock is not the monotonic one, the time can't be converted */
+  if (age > 60 * 1000)
+    return 0;
+
+  return now - (gint64) age * 1000;
+}
+
+
+
 static gboolean
 sn_button_button_release (GtkWidget      *widget,
                           GdkEventButton *event)
 {
   SnButton *button = XFCE_SN_BUTTON (widget);
   gboolean  menu_is_primary;
+  gint64    input_time;
+
+  /* start of input to dispatch latency */
+  input_time = sn_button_event_time ((GdkEvent *) event);
 
   menu_is_primary = sn_config_get_menu_is_primary (button->config);
 
@@ -304,14 +346,17 @@ sn_button_button_release (GtkWidget      *widget,
     {
       /* menu could be handled in button-press-event, check this */
       if (button->menu == NULL || !(button->menu_only || menu_is_primary))
-        sn_item_activate (button->item, (gint) event->x_root, (gint) event->y_root);
+        sn_item_activate (button->item, (gint) event->x_root, (gint) event->y_root,
+                          input_time);
     }
   else if (event->button == 2)
     {
       if (menu_is_primary && !button->menu_only)
-        sn_item_activate (button->item, (gint) event->x_root, (gint) event->y_root);
+        sn_item_activate (button->item, (gint) event->x_root, (gint) event->y_root,
+                          input_time);
       else
-        sn_item_secondary_activate (button->item, (gint) event->x_root, (gint) event->y_root);
+        sn_item_secondary_activate (button->item, (gint) event->x_root, (gint) event->y_root,
+                                    input_time);
     }
 
   /* process animations */
@@ -322,6 +367,32 @@ sn_button_button_release (GtkWidget      *widget,
 
 
 
+static gboolean
+sn_button_scroll_tick (GtkWidget     *widget,
+                       GdkFrameClock *frame_clock,
+                       gpointer       user_data)
+{
+  SnButton *button = XFCE_SN_BUTTON (widget);
+  gint      delta_x, delta_y;
+
+  /* send all steps accumulated since the last call at once */
+  if (sn_scroll_queue_flush (&button->scroll_queue,
+                             gdk_frame_clock_get_frame_time (frame_clock),
+                             sn_config_get_scroll_rate (button->config),
+                             &delta_x, &delta_y))
+    sn_item_scroll (button->item, delta_x, delta_y);
+
+  /* steps held back by the rate are sent on a later frame */
+  if (!sn_scroll_queue_is_empty (&button->scroll_queue))
+    return G_SOURCE_CONTINUE;
+
+  button->scroll_tick_handler = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
 static gboolean
 sn_button_scroll_event (GtkWidget      *widget,
                         GdkEventScroll *event)
@@ -337,11 +408,13 @@ sn_button_scroll_event (GtkWidget      *widget,
 
   if (delta_x != 0 || delta_y != 0)
     {
-      delta_x = (delta_x == 0 ? 0 : delta_x > 0 ? 1 : -1) *
-                MAX (ABS (delta_x) + 0.5, 1);
-      delta_y = (delta_y == 0 ? 0 : delta_y > 0 ? 1 : -1) *
-                MAX (ABS (delta_y) + 0.5, 1);
-      sn_item_scroll (button->item, (gint) delta_x, (gint) delta_y);
+      sn_scroll_queue_add (&button->scroll_queue, delta_x, delta_y);
+
+      if (button->scroll_tick_handler == 0)
+        {
+          button->scroll_tick_handler =
+            gtk_widget_add_tick_callback (widget, sn_button_scroll_tick, NULL, NULL);
+        }
     }
 
   return TRUE;
@@ -349,6 +422,22 @@ sn_button_scroll_event (GtkWidget      *widget,
 
 
 
+static gboolean
+sn_button_enter_notify (GtkWidget        *widget,
+                        GdkEventCrossing *event)
+{
+  SnButton *button = XFCE_SN_BUTTON (widget);
+
+  /* fetch the menu layout before it's likely to be shown,
+   * menus evicted from the cache are only built again on press */
+  if (!sn_item_has_evicted_menu (button->item))
+    sn_button_menu_attach (button);
+
+  return GTK_WIDGET_CLASS (sn_button_parent_class)->enter_notify_event (widget, event);
+}
+
+
+
 static gboolean
 sn_button_menu_size_changed_idle (gpointer user_data)
 {
@@ -378,43 +467,68 @@ sn_button_menu_size_changed (GtkWidget *widget)
 
 
 static void
-sn_button_menu_changed (GtkWidget *widget,
-                        SnItem    *item)
+sn_button_menu_detached (GtkWidget *widget,
+                         GtkMenu   *menu)
 {
   SnButton *button = XFCE_SN_BUTTON (widget);
 
-  if (button->menu != NULL)
+  /* called for explicit detach and when cached menu is destroyed */
+  if (button->menu_deactivate_handler != 0)
     {
-      if (button->menu_deactivate_handler != 0)
-        {
-          g_signal_handler_disconnect (button->menu, button->menu_deactivate_handler);
-          button->menu_deactivate_handler = 0;
+      g_signal_handler_disconnect (menu, button->menu_deactivate_handler);
+      button->menu_deactivate_handler = 0;
 
-          gtk_widget_unset_state_flags (widget, GTK_STATE_FLAG_ACTIVE);
-          gtk_menu_popdown (GTK_MENU (button->menu));
-        }
+      gtk_widget_unset_state_flags (widget, GTK_STATE_FLAG_ACTIVE);
+    }
 
-      if (button->menu_size_allocate_handler != 0)
-        {
-          g_signal_handler_disconnect (button->menu, button->menu_size_allocate_handler);
-          button->menu_size_allocate_handler = 0;
-        }
+  if (button->menu_size_allocate_handler != 0)
+    {
+      g_signal_handler_disconnect (menu, button->menu_size_allocate_handler);
+      button->menu_size_allocate_handler = 0;
+    }
+
+  if (button->menu_size_allocate_idle_handler != 0)
+    {
+      g_source_remove (button->menu_size_allocate_idle_handler);
+      button->menu_size_allocate_idle_handler = 0;
+    }
+
+  button->menu = NULL;
+}
 
-      if (button->menu_size_allocate_idle_handler != 0)
-        {
-          g_source_remove (button->menu_size_allocate_idle_handler);
-          button->menu_size_allocate_idle_handler = 0;
-        }
+
+
+static void
+sn_button_menu_detach (SnButton *button)
+{
+  if (button->menu != NULL)
+    {
+      if (button->menu_deactivate_handler != 0)
+        gtk_menu_popdown (GTK_MENU (button->menu));
 
       gtk_menu_detach (GTK_MENU (button->menu));
     }
+}
 
-  button->menu_only = sn_item_is_menu_only (item);
-  button->menu = sn_item_get_menu (item);
+
+
+static void
+sn_button_menu_attach (SnButton *button)
+{
+  GtkWidget *menu;
+
+  menu = sn_item_get_menu (button->item);
+  if (menu == button->menu)
+    return;
+
+  sn_button_menu_detach (button);
+
+  button->menu = menu;
 
   if (button->menu != NULL)
     {
-      gtk_menu_attach_to_widget (GTK_MENU (button->menu), GTK_WIDGET (button), NULL);
+      gtk_menu_attach_to_widget (GTK_MENU (button->menu), GTK_WIDGET (button),
+                                 sn_button_menu_detached);
       /* restore menu position to its corner if size was changed */
       button->menu_size_allocate_handler =
         g_signal_connect_swapped (button->menu, "size-allocate",
@@ -424,6 +538,36 @@ sn_button_menu_changed (GtkWidget *widget,
 
 
 
+static void
+sn_button_menu_changed (GtkWidget *widget,
+                        SnItem    *item)
+{
+  SnButton *button = XFCE_SN_BUTTON (widget);
+
+  button->menu_only = sn_item_is_menu_only (item);
+
+  /* the new menu is only built when it's likely to be shown */
+  sn_button_menu_detach (button);
+}
+
+
+
+static void
+sn_button_state_changed (GtkWidget   *widget,
+                         SnItemState *state,
+                         guint        changes)
+{
+  SnButton *button = XFCE_SN_BUTTON (widget);
+
+  if (changes & SN_ITEM_STATE_TOOLTIP)
+    gtk_widget_trigger_tooltip_query (widget);
+
+  if (changes & SN_ITEM_STATE_MENU)
+    sn_button_menu_changed (widget, button->item);
+}
+
+
+
 static gboolean
 sn_button_query_tooltip (GtkWidget  *widget,
                          gint        x,
@@ -433,23 +577,22 @@ sn_button_query_tooltip (GtkWidget  *widget,
                          gpointer    user_data)
 {
   SnButton    *button = XFCE_SN_BUTTON (widget);
-  const gchar *tooltip_title;
-  const gchar *tooltip_subtitle;
+  SnItemState *state;
   gchar       *full;
 
-  sn_item_get_tooltip (button->item, &tooltip_title, &tooltip_subtitle);
+  state = sn_item_get_state (button->item);
 
-  if (tooltip_title != NULL)
+  if (state->tooltip_title != NULL)
     {
-      if (tooltip_subtitle != NULL)
+      if (state->tooltip_subtitle != NULL)
         {
-          full = g_strdup_printf ("<b>%s</b>\n%s", tooltip_title, tooltip_subtitle);
+          full = g_strdup_printf ("<b>%s</b>\n%s", state->tooltip_title, state->tooltip_subtitle);
           gtk_tooltip_set_markup (tooltip, full);
           g_free (full);
         }
       else
         {
-          gtk_tooltip_set_markup (tooltip, tooltip_title);
+          gtk_tooltip_set_markup (tooltip, state->tooltip_title);
         }
 
       return TRUE;
@@ -48,6 +48,8 @@
 #define DEFAULT_PANEL_ORIENTATION  GTK_ORIENTATION_HORIZONTAL
 #define DEFAULT_PANEL_SIZE         28
 #define DEFAULT_MODE_WHITELIST     FALSE
+#define DEFAULT_MENU_CACHE_SIZE    8
+#define DEFAULT_SCROLL_RATE        0
 
 
 
@@ -80,6 +82,8 @@ struct _SnConfig
   gboolean            symbolic_icons;
   gboolean            menu_is_primary;
   gboolean            mode_whitelist;
+  guint               menu_cache_size;
+  guint               scroll_rate;
   GList              *known_items;
   GHashTable         *hidden_items;
 
@@ -103,6 +107,8 @@ enum
   PROP_SYMBOLIC_ICONS,
   PROP_MENU_IS_PRIMARY,
   PROP_MODE_WHITELIST,
+  PROP_MENU_CACHE_SIZE,
+  PROP_SCROLL_RATE,
   PROP_KNOWN_ITEMS,
   PROP_HIDDEN_ITEMS
 };
@@ -197,6 +203,20 @@ sn_config_class_init (SnConfigClass *klass)
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class,
+                                   PROP_MENU_CACHE_SIZE,
+                                   g_param_spec_uint ("menu-cache-size", NULL, NULL,
+                                                      1, 64, DEFAULT_MENU_CACHE_SIZE,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class,
+                                   PROP_SCROLL_RATE,
+                                   g_param_spec_uint ("scroll-rate", NULL, NULL,
+                                                      0, 1000, DEFAULT_SCROLL_RATE,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (object_class,
                                    PROP_KNOWN_ITEMS,
                                    g_param_spec_boxed ("known-items",
@@ -248,6 +268,8 @@ sn_config_init (SnConfig *config)
   config->square_icons         = DEFAULT_SQUARE_ICONS;
   config->symbolic_icons       = DEFAULT_SYMBOLIC_ICONS;
   config->mode_whitelist       = DEFAULT_MODE_WHITELIST;
+  config->menu_cache_size      = DEFAULT_MENU_CACHE_SIZE;
+  config->scroll_rate          = DEFAULT_SCROLL_RATE;
   config->known_items          = NULL;
   config->hidden_items         = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
@@ -337,6 +359,14 @@ sn_config_get_property (GObject    *object,
       g_value_set_boolean (value, config->mode_whitelist);
       break;
 
+    case PROP_MENU_CACHE_SIZE:
+      g_value_set_uint (value, config->menu_cache_size);
+      break;
+
+    case PROP_SCROLL_RATE:
+      g_value_set_uint (value, config->scroll_rate);
+      break;
+
     case PROP_KNOWN_ITEMS:
       array = g_ptr_array_new_full (1, sn_config_free_array_element);
       for (li = config->known_items; li != NULL; li = li->next)
@@ -434,6 +464,16 @@ sn_config_set_property (GObject      *object,
         }
       break;
 
+    case PROP_MENU_CACHE_SIZE:
+      /* doesn't affect the layout, listen to notify signal instead */
+      config->menu_cache_size = g_value_get_uint (value);
+      break;
+
+    case PROP_SCROLL_RATE:
+      /* read on every scroll, doesn't affect the layout */
+      config->scroll_rate = g_value_get_uint (value);
+      break;
+
     case PROP_KNOWN_ITEMS:
       g_list_free_full (config->known_items, g_free);
       config->known_items = NULL;
@@ -485,6 +525,26 @@ sn_config_get_icon_size (SnConfig *config)
 
 
 
+guint
+sn_config_get_menu_cache_size (SnConfig *config)
+{
+  g_return_val_if_fail (XFCE_IS_SN_CONFIG (config), DEFAULT_MENU_CACHE_SIZE);
+
+  return config->menu_cache_size;
+}
+
+
+
+guint
+sn_config_get_scroll_rate (SnConfig *config)
+{
+  g_return_val_if_fail (XFCE_IS_SN_CONFIG (config), DEFAULT_SCROLL_RATE);
+
+  return config->scroll_rate;
+}
+
+
+
 gboolean
 sn_config_get_single_row (SnConfig *config)
 {
@@ -825,6 +885,14 @@ sn_config_new (const gchar *property_base)
       xfconf_g_property_bind (channel, property, G_TYPE_BOOLEAN, config, "mode-whitelist");
       g_free (property);
 
+      property = g_strconcat (property_base, "/menu-cache-size", NULL);
+      xfconf_g_property_bind (channel, property, G_TYPE_UINT, config, "menu-cache-size");
+      g_free (property);
+
+      property = g_strconcat (property_base, "/scroll-rate", NULL);
+      xfconf_g_property_bind (channel, property, G_TYPE_UINT, config, "scroll-rate");
+      g_free (property);
+
       property = g_strconcat (property_base, "/known-items", NULL);
       xfconf_g_property_bind (channel, property, XFCE_TYPE_SN_CONFIG_VALUE_ARRAY, config, "known-items");
       g_free (property);
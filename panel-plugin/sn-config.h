@@ -64,6 +64,10 @@ gboolean               sn_config_get_menu_is_primary           (SnConfig
 
 gint                   sn_config_get_icon_size                 (SnConfig                *config);
 
+guint                  sn_config_get_menu_cache_size           (SnConfig                *config);
+
+guint                  sn_config_get_scroll_rate               (SnConfig                *config);
+
 gboolean               sn_config_is_hidden                     (SnConfig                *config,
                                                                 const gchar             *name);
 
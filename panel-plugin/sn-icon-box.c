@@ -25,15 +25,38 @@
 #include <string.h>
 #endif
 
+#include <glib/gstdio.h>
 #include <libxfce4panel/libxfce4panel.h>
 
 #include "sn-icon-box.h"
+#include "sn-icon-cache.h"
+#include "sn-icon-index.h"
+#include "sn-pixmap.h"
+#include "sn-raster-cache.h"
 #include "sn-util.h"
 
 
 
+static void                  sn_icon_box_dispose                     (GObject                 *object);
+
+static void                  sn_icon_box_finalize                    (GObject                 *object);
+
+static void                  sn_icon_box_unregister                  (SnIconBox               *box);
+
+static void                  sn_icon_box_update                      (SnIconBox               *box,
+                                                                      gboolean                 update_icon,
+                                                                      gboolean                 update_overlay);
+
 static void                  sn_icon_box_icon_changed                (GtkWidget               *widget);
 
+static void                  sn_icon_box_icon_theme_changed          (GtkWidget               *widget);
+
+static void                  sn_icon_box_state_changed               (GtkWidget               *widget,
+                                                                      SnItemState             *state,
+                                                                      guint                    changes);
+
+static void                  sn_icon_box_style_updated               (GtkWidget               *widget);
+
 static void                  sn_icon_box_get_preferred_width         (GtkWidget               *widget,
                                                                       gint                    *minimum_width,
                                                                       gint                    *natural_width);
@@ -68,21 +91,92 @@ struct _SnIconBox
   SnItem              *item;
   SnConfig            *config;
 
-  GtkWidget           *icon;
-  GtkWidget           *overlay;
+  /* icon and overlay are composited into the single image */
+  GtkWidget           *image;
+
+  /* layers in device pixels, premultiplied like everything cairo paints */
+  cairo_surface_t     *icon_layer;
+  cairo_surface_t     *overlay_layer;
+  gboolean             icon_symbolic;
+  gboolean             overlay_symbolic;
+
+  /* pending loads of the layers */
+  GCancellable        *icon_cancellable;
+  GCancellable        *overlay_cancellable;
+
+  /* composited layers in device pixels, rendered for the scale and size */
+  cairo_surface_t     *surface;
+  gint                 scale;
+  gint                 icon_size;
+
+  /* preferred size of the composited image */
+  gboolean             size_valid;
+  gint                 natural_width;
+  gint                 natural_height;
+
+  /* inputs the layers were rendered from */
+  SnItemState         *state;
+  gboolean             symbolic_icons;
+  gchar               *theme_name;
+
+  /* update requested from the shared pass */
+  gint                 pending;
+
+  SnIconIndex         *icon_index;
+  gulong               icon_index_handler;
 };
 
 G_DEFINE_TYPE (SnIconBox, sn_icon_box, GTK_TYPE_CONTAINER)
 
 
 
+typedef struct
+{
+  gboolean             overlay;
+  gchar               *path;
+  cairo_surface_t     *surface;
+  SnIconRender        *render;
+  gint                 pixel_size;
+
+  /* state of the file when it was decoded */
+  gint64               mtime;
+  goffset              size;
+}
+LoadJob;
+
+
+
+enum
+{
+  PENDING_NONE,
+  PENDING_CHECK,
+  PENDING_FORCE
+};
+
+
+
+/* boxes re-rendered together when a shared input changes */
+static GList                *sn_icon_box_instances = NULL;
+static guint                 sn_icon_box_pass_source = 0;
+static gulong                sn_icon_box_theme_name_handler = 0;
+static gulong                sn_icon_box_icon_theme_name_handler = 0;
+static gulong                sn_icon_box_icon_theme_handler = 0;
+
+
+
 static void
 sn_icon_box_class_init (SnIconBoxClass *klass)
 {
+  GObjectClass      *object_class;
   GtkWidgetClass    *widget_class;
   GtkContainerClass *container_class;
 
+  object_class = G_OBJECT_CLASS (klass);
+  object_class->dispose = sn_icon_box_dispose;
+  object_class->finalize = sn_icon_box_finalize;
+
   widget_class = GTK_WIDGET_CLASS (klass);
+  widget_class->style_updated = sn_icon_box_style_updated;
   widget_class->get_preferred_width = sn_icon_box_get_preferred_width;
   widget_class->get_preferred_height = sn_icon_box_get_preferred_height;
   widget_class->size_allocate = sn_icon_box_size_allocate;
@@ -107,8 +201,90 @@ sn_icon_box_init (SnIconBox *box)
   box->item = NULL;
   box->config = NULL;
 
-  box->icon = NULL;
-  box->overlay = NULL;
+  box->image = NULL;
+
+  box->icon_layer = NULL;
+  box->overlay_layer = NULL;
+  box->icon_symbolic = FALSE;
+  box->overlay_symbolic = FALSE;
+
+  box->icon_cancellable = NULL;
+  box->overlay_cancellable = NULL;
+
+  box->surface = NULL;
+  box->scale = 1;
+  box->icon_size = 0;
+
+  box->size_valid = FALSE;
+  box->natural_width = 0;
+  box->natural_height = 0;
+
+  box->state = NULL;
+  box->symbolic_icons = FALSE;
+  box->theme_name = NULL;
+
+  box->pending = PENDING_NONE;
+
+  box->icon_index = NULL;
+  box->icon_index_handler = 0;
+}
+
+
+
+static void
+sn_icon_box_dispose (GObject *object)
+{
+  SnIconBox *box = XFCE_SN_ICON_BOX (object);
+
+  sn_icon_box_unregister (box);
+
+  /* the item might be freed right after the box is removed */
+  if (box->icon_cancellable != NULL)
+    {
+      g_cancellable_cancel (box->icon_cancellable);
+      g_clear_object (&box->icon_cancellable);
+    }
+
+  if (box->overlay_cancellable != NULL)
+    {
+      g_cancellable_cancel (box->overlay_cancellable);
+      g_clear_object (&box->overlay_cancellable);
+    }
+
+  G_OBJECT_CLASS (sn_icon_box_parent_class)->dispose (object);
+}
+
+
+
+static void
+sn_icon_box_finalize (GObject *object)
+{
+  SnIconBox *box = XFCE_SN_ICON_BOX (object);
+
+  g_clear_object (&box->icon_cancellable);
+  g_clear_object (&box->overlay_cancellable);
+
+  if (box->icon_layer != NULL)
+    cairo_surface_destroy (box->icon_layer);
+
+  if (box->overlay_layer != NULL)
+    cairo_surface_destroy (box->overlay_layer);
+
+  if (box->surface != NULL)
+    cairo_surface_destroy (box->surface);
+
+  if (box->state != NULL)
+    sn_item_state_unref (box->state);
+
+  g_free (box->theme_name);
+
+  if (box->icon_index != NULL)
+    {
+      g_signal_handler_disconnect (box->icon_index, box->icon_index_handler);
+      g_object_unref (box->icon_index);
+    }
+
+  G_OBJECT_CLASS (sn_icon_box_parent_class)->finalize (object);
 }
 
 
@@ -129,13 +305,8 @@ sn_icon_box_forall (GtkContainer *container,
 {
   SnIconBox *box = XFCE_SN_ICON_BOX (container);
 
-  /* z-order depends on forall order */
-
-  if (box->overlay != NULL)
-    (*callback) (box->overlay, callback_data);
-
-  if (box->icon != NULL)
-    (*callback) (box->icon, callback_data);
+  if (box->image != NULL)
+    (*callback) (box->image, callback_data);
 }
 
 
@@ -150,18 +321,139 @@ sn_icon_box_remove (GtkContainer *container,
 
   box = XFCE_SN_ICON_BOX (container);
 
-  if (child == box->icon)
+  if (child == box->image)
     {
       gtk_widget_unparent (child);
-      box->icon = NULL;
+      box->image = NULL;
     }
-  else if (child == box->overlay)
+
+  gtk_widget_queue_resize (GTK_WIDGET (container));
+}
+
+
+
+static gboolean
+sn_icon_box_pass (gpointer user_data)
+{
+  GList     *li;
+  SnIconBox *box;
+
+  sn_icon_box_pass_source = 0;
+
+  /* resizes queued here are handled by a single layout run */
+  for (li = sn_icon_box_instances; li != NULL; li = li->next)
     {
-      gtk_widget_unparent (child);
-      box->overlay = NULL;
+      box = li->data;
+      if (box->pending != PENDING_NONE)
+        {
+          sn_icon_box_update (box, box->pending == PENDING_FORCE,
+                              box->pending == PENDING_FORCE);
+          box->pending = PENDING_NONE;
+        }
     }
 
-  gtk_widget_queue_resize (GTK_WIDGET (container));
+  return G_SOURCE_REMOVE;
+}
+
+
+
+static void
+sn_icon_box_schedule (SnIconBox *box,
+                      gint       pending)
+{
+  box->pending = MAX (box->pending, pending);
+
+  /* run before GTK processes resizes and redraws */
+  if (sn_icon_box_pass_source == 0)
+    sn_icon_box_pass_source = g_idle_add_full (G_PRIORITY_HIGH_IDLE, sn_icon_box_pass, NULL, NULL);
+}
+
+
+
+static void
+sn_icon_box_schedule_all (gint pending)
+{
+  GList *li;
+
+  for (li = sn_icon_box_instances; li != NULL; li = li->next)
+    sn_icon_box_schedule (li->data, pending);
+}
+
+
+
+static void
+sn_icon_box_theme_changed (GtkSettings *settings,
+                           GParamSpec  *pspec,
+                           gpointer     user_data)
+{
+  sn_icon_box_schedule_all (PENDING_CHECK);
+}
+
+
+
+static void
+sn_icon_box_default_icon_theme_changed (GtkIconTheme *icon_theme,
+                                        gpointer      user_data)
+{
+  sn_icon_box_schedule_all (PENDING_FORCE);
+}
+
+
+
+static void
+sn_icon_box_register (SnIconBox *box)
+{
+  GtkSettings  *settings;
+  GtkIconTheme *icon_theme;
+
+  if (sn_icon_box_instances == NULL)
+    {
+      /* connect shared sources only once for all boxes */
+      settings = gtk_settings_get_default ();
+      icon_theme = gtk_icon_theme_get_default ();
+
+      sn_icon_box_theme_name_handler =
+        g_signal_connect (settings, "notify::gtk-theme-name",
+                          G_CALLBACK (sn_icon_box_theme_changed), NULL);
+      sn_icon_box_icon_theme_name_handler =
+        g_signal_connect (settings, "notify::gtk-icon-theme-name",
+                          G_CALLBACK (sn_icon_box_theme_changed), NULL);
+      sn_icon_box_icon_theme_handler =
+        g_signal_connect (icon_theme, "changed",
+                          G_CALLBACK (sn_icon_box_default_icon_theme_changed), NULL);
+    }
+
+  sn_icon_box_instances = g_list_prepend (sn_icon_box_instances, box);
+}
+
+
+
+static void
+sn_icon_box_unregister (SnIconBox *box)
+{
+  GList *li;
+
+  li = g_list_find (sn_icon_box_instances, box);
+  if (li == NULL)
+    return;
+
+  sn_icon_box_instances = g_list_delete_link (sn_icon_box_instances, li);
+
+  if (sn_icon_box_instances == NULL)
+    {
+      g_signal_handler_disconnect (gtk_settings_get_default (), sn_icon_box_theme_name_handler);
+      g_signal_handler_disconnect (gtk_settings_get_default (), sn_icon_box_icon_theme_name_handler);
+      g_signal_handler_disconnect (gtk_icon_theme_get_default (), sn_icon_box_icon_theme_handler);
+      sn_icon_box_theme_name_handler = 0;
+      sn_icon_box_icon_theme_name_handler = 0;
+      sn_icon_box_icon_theme_handler = 0;
+
+      if (sn_icon_box_pass_source != 0)
+        {
+          g_source_remove (sn_icon_box_pass_source);
+          sn_icon_box_pass_source = 0;
+        }
+    }
 }
 
 
@@ -170,35 +462,31 @@ GtkWidget *
 sn_icon_box_new (SnItem   *item,
                  SnConfig *config)
 {
-  SnIconBox   *box = g_object_new (XFCE_TYPE_SN_ICON_BOX, NULL);
-  GtkSettings *settings;
+  SnIconBox    *box = g_object_new (XFCE_TYPE_SN_ICON_BOX, NULL);
 
   g_return_val_if_fail (XFCE_IS_SN_CONFIG (config), NULL);
 
   box->item = item;
   box->config = config;
 
-  box->icon = gtk_image_new ();
-  gtk_widget_set_parent (box->icon, GTK_WIDGET (box));
-  gtk_widget_show (box->icon);
-
-  box->overlay = gtk_image_new ();
-  gtk_widget_set_parent (box->overlay, GTK_WIDGET (box));
-  gtk_widget_show (box->overlay);
-
-  settings = gtk_settings_get_default ();
+  box->image = gtk_image_new ();
+  gtk_widget_set_parent (box->image, GTK_WIDGET (box));
+  gtk_widget_show (box->image);
 
   sn_signal_connect_weak_swapped (config, "notify::icon-size",
                                   G_CALLBACK (sn_icon_box_icon_changed), box);
   sn_signal_connect_weak_swapped (config, "notify::symbolic-icons",
                                   G_CALLBACK (sn_icon_box_icon_changed), box);
-  sn_signal_connect_weak_swapped (item, "icon-changed",
-                                  G_CALLBACK (sn_icon_box_icon_changed), box);
-  sn_signal_connect_weak_swapped (settings, "notify::gtk-theme-name",
-                                  G_CALLBACK (sn_icon_box_icon_changed), box);
-  sn_signal_connect_weak_swapped (settings, "notify::gtk-icon-theme-name",
-                                  G_CALLBACK (sn_icon_box_icon_changed), box);
-  sn_icon_box_icon_changed (GTK_WIDGET (box));
+  sn_signal_connect_weak_swapped (item, "state-changed",
+                                  G_CALLBACK (sn_icon_box_state_changed), box);
+
+  g_signal_connect (box, "notify::scale-factor",
+                    G_CALLBACK (sn_icon_box_icon_changed), NULL);
+
+  /* theme changes are handled for all boxes at once */
+  sn_icon_box_register (box);
+
+  sn_icon_box_update (box, FALSE, FALSE);
 
   return GTK_WIDGET (box);
 }
@@ -206,39 +494,407 @@ sn_icon_box_new (SnItem   *item,
 
 
 static void
-sn_icon_box_apply_icon (GtkWidget    *image,
-                        GtkIconTheme *icon_theme,
-                        GtkIconTheme *icon_theme_from_path,
-                        const gchar  *icon_name,
-                        GdkPixbuf    *icon_pixbuf,
-                        gint          icon_size,
-                        gboolean      prefer_symbolic)
-{
-  GtkIconInfo *icon_info = NULL;
-  GdkPixbuf   *work_pixbuf = NULL;
-  gchar       *work_icon_name = NULL;
-  gchar       *symbolic_icon_name = NULL;
-  gint         symbolic_icon_size;
-  gboolean     use_pixbuf = TRUE;
-  gboolean     use_symbolic = FALSE;
-  gint         width, height;
-  gchar       *s1, *s2;
-  gint         max_size = icon_size;
-
-  gtk_image_clear (GTK_IMAGE (image));
+sn_icon_box_composite (SnIconBox *box)
+{
+  cairo_surface_t *surface;
+  cairo_t         *cr;
+  gint             width = 0, height = 0;
+  gdouble          x_scale, y_scale;
+
+  if (box->icon_layer != NULL)
+    {
+      width = cairo_image_surface_get_width (box->icon_layer);
+      height = cairo_image_surface_get_height (box->icon_layer);
+    }
+
+  if (box->overlay_layer != NULL)
+    {
+      width = MAX (width, cairo_image_surface_get_width (box->overlay_layer));
+      height = MAX (height, cairo_image_surface_get_height (box->overlay_layer));
+    }
+
+  if (width == 0 || height == 0)
+    {
+      if (box->surface != NULL)
+        {
+          cairo_surface_destroy (box->surface);
+          box->surface = NULL;
+
+          /* the preferred size follows the image */
+          box->size_valid = FALSE;
+          gtk_image_clear (GTK_IMAGE (box->image));
+          gtk_widget_queue_resize (GTK_WIDGET (box));
+        }
+      return;
+    }
+
+  surface = box->surface;
+  if (surface != NULL)
+    {
+      cairo_surface_get_device_scale (surface, &x_scale, &y_scale);
+      if (cairo_image_surface_get_width (surface) != width ||
+          cairo_image_surface_get_height (surface) != height ||
+          x_scale != box->scale || y_scale != box->scale)
+        surface = NULL;
+    }
+
+  if (surface == NULL)
+    {
+      surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+      cr = cairo_create (surface);
+    }
+  else
+    {
+      /* same size, the image shows the surface painted again in place,
+       * so restyling symbolic icons doesn't relayout the panel */
+      cairo_surface_set_device_scale (surface, 1, 1);
+      cr = cairo_create (surface);
+      cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+      cairo_paint (cr);
+      cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+    }
+
+  /* both layers are centered, the overlay is painted on top of the icon */
+  if (box->icon_layer != NULL)
+    {
+      cairo_set_source_surface (cr, box->icon_layer,
+                                (width - cairo_image_surface_get_width (box->icon_layer)) / 2,
+                                (height - cairo_image_surface_get_height (box->icon_layer)) / 2);
+      cairo_paint (cr);
+    }
+
+  if (box->overlay_layer != NULL)
+    {
+      cairo_set_source_surface (cr, box->overlay_layer,
+                                (width - cairo_image_surface_get_width (box->overlay_layer)) / 2,
+                                (height - cairo_image_surface_get_height (box->overlay_layer)) / 2);
+      cairo_paint (cr);
+    }
+
+  cairo_destroy (cr);
+
+  /* layers are painted in device pixels, let GTK map them to the logical size */
+  cairo_surface_set_device_scale (surface, box->scale, box->scale);
+
+  if (surface == box->surface)
+    {
+      cairo_surface_mark_dirty (surface);
+      gtk_widget_queue_draw (box->image);
+      return;
+    }
+
+  if (box->surface != NULL)
+    cairo_surface_destroy (box->surface);
+  box->surface = surface;
+  gtk_image_set_from_surface (GTK_IMAGE (box->image), surface);
+
+  /* the preferred size follows the image */
+  box->size_valid = FALSE;
+  gtk_widget_queue_resize (GTK_WIDGET (box));
+}
+
+
+
+static void
+sn_icon_box_set_theme_path (SnIconBox   *box,
+                            const gchar *theme_path)
+{
+  SnIconIndex *icon_index;
+
+  /* indexes are shared between all items using the same path */
+  icon_index = theme_path != NULL ? sn_icon_index_get (theme_path) : NULL;
+
+  if (icon_index == box->icon_index)
+    {
+      if (icon_index != NULL)
+        g_object_unref (icon_index);
+      return;
+    }
+
+  if (box->icon_index != NULL)
+    {
+      g_signal_handler_disconnect (box->icon_index, box->icon_index_handler);
+      g_object_unref (box->icon_index);
+      box->icon_index_handler = 0;
+    }
+
+  box->icon_index = icon_index;
+
+  if (icon_index != NULL)
+    {
+      box->icon_index_handler =
+        g_signal_connect_swapped (icon_index, "changed",
+                                  G_CALLBACK (sn_icon_box_icon_theme_changed), box);
+    }
+}
+
+
+
+static void
+sn_icon_box_load_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+  LoadJob         *job = task_data;
+  GdkPixbuf       *pixbuf = NULL;
+  cairo_surface_t *surface;
+  GStatBuf         st;
+  gint             width, height;
+  gchar           *key;
+
+  if (job->render != NULL)
+    {
+      pixbuf = sn_icon_cache_render (job->render);
+      g_task_return_pointer (task, pixbuf, pixbuf != NULL ? g_object_unref : NULL);
+      return;
+    }
+
+  if (job->path == NULL)
+    {
+      width = cairo_image_surface_get_width (job->surface);
+      height = cairo_image_surface_get_height (job->surface);
+
+      /* scale surface */
+      if (height > width)
+        {
+          height = job->pixel_size * height / width;
+          width = job->pixel_size;
+        }
+      else
+        {
+          width = job->pixel_size * width / height;
+          height = job->pixel_size;
+        }
+
+      surface = sn_pixmap_surface_scale (job->surface, width, height);
+      g_task_return_pointer (task, surface, (GDestroyNotify) cairo_surface_destroy);
+      return;
+    }
+
+  /* the file cache compares against the state before decoding */
+  if (g_stat (job->path, &st) == 0)
+    {
+      job->mtime = st.st_mtime;
+      job->size = st.st_size;
+
+      key = g_strdup_printf ("file:%s:%" G_GINT64_FORMAT ":%" G_GOFFSET_FORMAT ":%d",
+                             job->path, job->mtime, job->size, job->pixel_size);
+      pixbuf = sn_raster_cache_lookup (key);
+
+      if (pixbuf == NULL)
+        {
+          pixbuf = gdk_pixbuf_new_from_file (job->path, NULL);
+
+          if (pixbuf != NULL &&
+              (gdk_pixbuf_get_width (pixbuf) <= 1 || gdk_pixbuf_get_height (pixbuf) <= 1))
+            {
+              /* icon size was incorrect, try to pass the desired icon size */
+              g_object_unref (pixbuf);
+              pixbuf = gdk_pixbuf_new_from_file_at_size (job->path,
+                                                         job->pixel_size, job->pixel_size,
+                                                         NULL);
+            }
+
+          if (pixbuf != NULL)
+            sn_raster_cache_store (key, pixbuf);
+        }
+
+      g_free (key);
+    }
+
+  g_task_return_pointer (task, pixbuf, pixbuf != NULL ? g_object_unref : NULL);
+}
+
+
+
+static void
+sn_icon_box_load_job_free (gpointer data)
+{
+  LoadJob *job = data;
+
+  g_free (job->path);
+  if (job->surface != NULL)
+    cairo_surface_destroy (job->surface);
+  if (job->render != NULL)
+    sn_icon_cache_render_free (job->render);
+  g_free (job);
+}
+
+
+
+static void
+sn_icon_box_set_layer (SnIconBox       *box,
+                       gboolean         overlay,
+                       cairo_surface_t *surface,
+                       gboolean         symbolic)
+{
+  if (overlay)
+    {
+      if (box->overlay_layer != NULL)
+        cairo_surface_destroy (box->overlay_layer);
+      box->overlay_layer = surface;
+      box->overlay_symbolic = symbolic;
+    }
+  else
+    {
+      if (box->icon_layer != NULL)
+        cairo_surface_destroy (box->icon_layer);
+      box->icon_layer = surface;
+      box->icon_symbolic = symbolic;
+    }
+}
+
+
+
+static void
+sn_icon_box_load_finished (GObject      *source_object,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+  SnIconBox    *box = XFCE_SN_ICON_BOX (source_object);
+  LoadJob      *job = g_task_get_task_data (G_TASK (res));
+  SnIconRender *render;
+  gpointer      result;
+  GError       *error = NULL;
+
+  result = g_task_propagate_pointer (G_TASK (res), &error);
+
+  /* icon infos must not be released in the worker, where the task may end */
+  render = job->render;
+  job->render = NULL;
+
+  if (error != NULL)
+    {
+      /* superseded by a newer update */
+      g_error_free (error);
+      if (render != NULL)
+        sn_icon_cache_render_free (render);
+      return;
+    }
+
+  if (box->image == NULL)
+    {
+      /* finished after dispose, the results are not needed anymore */
+      if (result != NULL && (job->path != NULL || render != NULL))
+        g_object_unref (result);
+      else if (result != NULL)
+        cairo_surface_destroy (result);
+      if (render != NULL)
+        sn_icon_cache_render_free (render);
+      return;
+    }
+
+  if (job->overlay)
+    g_clear_object (&box->overlay_cancellable);
+  else
+    g_clear_object (&box->icon_cancellable);
+
+  if (render != NULL)
+    {
+      /* resolve the layer again, the icon is rendered in the cache now */
+      sn_icon_cache_add_icon (render, result);
+      sn_icon_cache_render_free (render);
+      if (result != NULL)
+        g_object_unref (result);
+
+      sn_icon_box_update (box, !job->overlay, job->overlay);
+      return;
+    }
+
+  if (job->path != NULL)
+    {
+      /* resolve the layer again, the file is known to the cache now */
+      sn_icon_cache_add_file (job->path, job->pixel_size, job->mtime, job->size, result);
+      if (result != NULL)
+        g_object_unref (result);
+
+      sn_icon_box_update (box, !job->overlay, job->overlay);
+      return;
+    }
+
+  sn_icon_box_set_layer (box, job->overlay, result, FALSE);
+  sn_icon_box_composite (box);
+}
+
+
+
+static void
+sn_icon_box_load_async (SnIconBox       *box,
+                        gboolean         overlay,
+                        const gchar     *path,
+                        cairo_surface_t *surface,
+                        SnIconRender    *render)
+{
+  GCancellable *cancellable;
+  LoadJob      *job;
+  GTask        *task;
+
+  job = g_new0 (LoadJob, 1);
+  job->overlay = overlay;
+  job->path = g_strdup (path);
+  job->surface = surface != NULL ? cairo_surface_reference (surface) : NULL;
+  job->render = render;
+  job->pixel_size = box->icon_size * box->scale;
+
+  cancellable = g_cancellable_new ();
+  if (overlay)
+    box->overlay_cancellable = cancellable;
+  else
+    box->icon_cancellable = cancellable;
+
+  task = g_task_new (box, cancellable, sn_icon_box_load_finished, NULL);
+  g_task_set_task_data (task, job, sn_icon_box_load_job_free);
+  /* a render has to finish first, its icon info is released in the callback */
+  g_task_set_return_on_cancel (task, render == NULL);
+  g_task_run_in_thread (task, sn_icon_box_load_thread);
+  g_object_unref (task);
+}
+
+
+
+static gboolean
+sn_icon_box_load_icon (SnIconBox        *box,
+                       gboolean          overlay,
+                       const gchar      *icon_name,
+                       cairo_surface_t  *icon_surface,
+                       gboolean          prefer_symbolic,
+                       cairo_surface_t **result,
+                       gboolean         *is_symbolic)
+{
+  GtkStyleContext *context;
+  GtkIconTheme    *icon_theme;
+  GdkPixbuf       *work_pixbuf = NULL;
+  GdkPixbuf       *pixbuf;
+  SnIconRender    *render;
+  cairo_surface_t *source = NULL;
+  gchar           *work_icon_name = NULL;
+  gchar           *symbolic_icon_name;
+  const gchar     *filename;
+  gboolean         pending = FALSE;
+  gint             pixel_size;
+  gchar           *s1, *s2;
+
+  context = gtk_widget_get_style_context (GTK_WIDGET (box));
+  icon_theme = gtk_icon_theme_get_for_screen (gtk_widget_get_screen (GTK_WIDGET (box)));
+  pixel_size = box->icon_size * box->scale;
+
+  *result = NULL;
+  *is_symbolic = FALSE;
 
   #define sn_preferred_name() (work_icon_name != NULL ? work_icon_name : icon_name)
-  #define sn_preferred_pixbuf() (work_pixbuf != NULL ? work_pixbuf : icon_pixbuf)
 
   if (icon_name != NULL)
     {
       if (icon_name[0] =='/')
         {
-          /* it's a path to file */
-          if (g_file_test (icon_name, G_FILE_TEST_IS_REGULAR))
-            work_pixbuf = gdk_pixbuf_new_from_file (icon_name, NULL);
-
-          if (work_pixbuf == NULL)
+          /* it's a path to file, decoded in a thread when it has changed */
+          if (!sn_icon_cache_lookup_file (icon_name, pixel_size, &work_pixbuf))
+            {
+              sn_icon_box_load_async (box, overlay, icon_name, NULL, NULL);
+              pending = TRUE;
+            }
+          else if (work_pixbuf == NULL)
             {
               /* try to extract icon name from path */
               s1 = g_strrstr (icon_name, "/");
@@ -251,115 +907,100 @@ sn_icon_box_apply_icon (GtkWidget    *image,
             }
         }
 
-      if (work_pixbuf == NULL && icon_theme_from_path != NULL)
+      if (!pending && work_pixbuf == NULL && box->icon_index != NULL && prefer_symbolic)
         {
-          /* load icon in its real size */
-          work_pixbuf = gtk_icon_theme_load_icon (icon_theme_from_path,
-                                                  sn_preferred_name (),
-                                                  -1, 0, NULL);
+          /* private symbolic icons are recolored through the shared theme of the path */
+          if (g_str_has_suffix (sn_preferred_name (), "-symbolic"))
+            symbolic_icon_name = g_strdup (sn_preferred_name ());
+          else
+            symbolic_icon_name = g_strdup_printf ("%s-symbolic", sn_preferred_name ());
 
-          if (work_pixbuf == NULL ||
-              (gdk_pixbuf_get_width (work_pixbuf) <= 1 || gdk_pixbuf_get_height (work_pixbuf) <= 1))
+          if (!sn_icon_index_lookup (box->icon_index, symbolic_icon_name, pixel_size, &filename))
             {
-              if (work_pixbuf != NULL)
-                g_object_unref (work_pixbuf);
-
-              /* icon size was incorrect, try to pass the desired icon size */
-              work_pixbuf = gtk_icon_theme_load_icon (icon_theme_from_path,
-                                                      sn_preferred_name (),
-                                                      icon_size, 0, NULL);
+              pending = TRUE;
             }
-        }
-
-      if (work_pixbuf == NULL)
-        {
-          if (prefer_symbolic && strstr (sn_preferred_name (), "-symbolic") == NULL)
+          else if (filename != NULL)
             {
-              symbolic_icon_name = g_strdup_printf ("%s-symbolic", sn_preferred_name ());
-
-              symbolic_icon_size = icon_size;
-              if (symbolic_icon_size <= 48)
+              if (!sn_icon_cache_load_icon (sn_icon_index_get_icon_theme (box->icon_index),
+                                            context, symbolic_icon_name,
+                                            box->icon_size, box->scale, TRUE,
+                                            &pixbuf, is_symbolic, &render))
                 {
-                  /* calculate highest bit (e.g. 22 -> 16, 63 -> 32) */
-                  symbolic_icon_size |= symbolic_icon_size >> 1;
-                  symbolic_icon_size |= symbolic_icon_size >> 2;
-                  symbolic_icon_size |= symbolic_icon_size >> 4;
-                  symbolic_icon_size |= symbolic_icon_size >> 8;
-                  symbolic_icon_size |= symbolic_icon_size >> 16;
-                  symbolic_icon_size = symbolic_icon_size - (symbolic_icon_size >> 1);
+                  sn_icon_box_load_async (box, overlay, NULL, NULL, render);
+                  pending = TRUE;
                 }
-
-              icon_info = gtk_icon_theme_lookup_icon (icon_theme,
-                                                      symbolic_icon_name,
-                                                      symbolic_icon_size,
-                                                      0);
-              if (icon_info != NULL)
+              else if (pixbuf != NULL)
                 {
-                  if (gtk_icon_info_is_symbolic (icon_info))
-                    {
-                      use_symbolic = TRUE;
-                      max_size = symbolic_icon_size;
-                    }
-                  else
-                    {
-                      g_object_unref (icon_info);
-                      icon_info = NULL;
-                    }
+                  *result = gdk_cairo_surface_create_from_pixbuf (pixbuf, 1, NULL);
+                  g_object_unref (pixbuf);
                 }
             }
 
-          if (icon_info == NULL)
+          g_free (symbolic_icon_name);
+        }
+
+      if (!pending && work_pixbuf == NULL && *result == NULL && box->icon_index != NULL)
+        {
+          /* private icons are looked up in the index of the theme path,
+           * the icon is resolved again when the index is ready */
+          if (!sn_icon_index_lookup (box->icon_index, sn_preferred_name (), pixel_size, &filename))
+            {
+              pending = TRUE;
+            }
+          else if (filename != NULL && !sn_icon_cache_lookup_file (filename, pixel_size, &work_pixbuf))
             {
-              icon_info = gtk_icon_theme_lookup_icon (icon_theme,
-                                                      sn_preferred_name (),
-                                                      icon_size, 0);
+              sn_icon_box_load_async (box, overlay, filename, NULL, NULL);
+              pending = TRUE;
             }
+        }
 
-          if (icon_info != NULL)
+      if (!pending && work_pixbuf == NULL && *result == NULL)
+        {
+          /* theme icons which are not in memory yet are decoded in a thread */
+          if (!sn_icon_cache_load_icon (icon_theme, context, sn_preferred_name (),
+                                        box->icon_size, box->scale, prefer_symbolic,
+                                        &pixbuf, is_symbolic, &render))
             {
-              gtk_image_set_from_icon_name (GTK_IMAGE (image),
-                                            use_symbolic
-                                            ? symbolic_icon_name
-                                            : sn_preferred_name (),
-                                            GTK_ICON_SIZE_BUTTON);
-              g_object_unref (icon_info);
-              use_pixbuf = FALSE;
+              sn_icon_box_load_async (box, overlay, NULL, NULL, render);
+              pending = TRUE;
+            }
+          else if (pixbuf != NULL)
+            {
+              *result = gdk_cairo_surface_create_from_pixbuf (pixbuf, 1, NULL);
+              g_object_unref (pixbuf);
             }
         }
     }
 
-  if (use_pixbuf && sn_preferred_pixbuf () != NULL)
+  #undef sn_preferred_name
+
+  if (!pending && *result == NULL)
     {
-      width = gdk_pixbuf_get_width (sn_preferred_pixbuf ());
-      height = gdk_pixbuf_get_height (sn_preferred_pixbuf ());
+      /* pixmaps arrive as premultiplied surfaces already */
+      if (work_pixbuf != NULL)
+        source = gdk_cairo_surface_create_from_pixbuf (work_pixbuf, 1, NULL);
+      else if (icon_surface != NULL)
+        source = cairo_surface_reference (icon_surface);
 
-      if (width > icon_size && height > icon_size)
+      if (source != NULL)
         {
-          /* scale pixbuf */
-          if (height > width)
+          /* use all the resolution the app sent, up to the device pixel size */
+          if (cairo_image_surface_get_width (source) > pixel_size &&
+              cairo_image_surface_get_height (source) > pixel_size)
             {
-              height = icon_size * height / width;
-              width = icon_size;
+              sn_icon_box_load_async (box, overlay, NULL, source, NULL);
+              pending = TRUE;
             }
           else
             {
-              width = icon_size * width / height;
-              height = icon_size;
+              *result = cairo_surface_reference (source);
             }
 
-          icon_pixbuf = gdk_pixbuf_scale_simple (sn_preferred_pixbuf (),
-                                                 width, height, GDK_INTERP_BILINEAR);
-          gtk_image_set_from_pixbuf (GTK_IMAGE (image), icon_pixbuf);
-          g_object_unref (icon_pixbuf);
-        }
-      else
-        {
-          gtk_image_set_from_pixbuf (GTK_IMAGE (image), sn_preferred_pixbuf ());
+          cairo_surface_destroy (source);
         }
-    }
 
-  #undef sn_preferred_pixbuf
-  #undef sn_preferred_name
+      *is_symbolic = FALSE;
+    }
 
   if (work_pixbuf != NULL)
     g_object_unref (work_pixbuf);
@@ -367,50 +1008,154 @@ sn_icon_box_apply_icon (GtkWidget    *image,
   if (work_icon_name != NULL)
     g_free (work_icon_name);
 
-  if (symbolic_icon_name != NULL)
-    g_free (symbolic_icon_name);
-
-  gtk_image_set_pixel_size (GTK_IMAGE (image), max_size);
+  return !pending;
 }
 
 
 
 static void
-sn_icon_box_icon_changed (GtkWidget *widget)
+sn_icon_box_update (SnIconBox *box,
+                    gboolean   update_icon,
+                    gboolean   update_overlay)
 {
-  SnIconBox    *box;
-  const gchar  *icon_name;
-  GdkPixbuf    *icon_pixbuf;
-  const gchar  *overlay_icon_name;
-  GdkPixbuf    *overlay_icon_pixbuf;
-  const gchar  *theme_path;
-  GtkIconTheme *icon_theme;
-  GtkIconTheme *icon_theme_from_path = NULL;
-  gint          icon_size;
-  gboolean      symbolic_icons;
-
-  box = XFCE_SN_ICON_BOX (widget);
-  icon_theme = gtk_icon_theme_get_for_screen (gtk_widget_get_screen (GTK_WIDGET (widget)));
-  icon_size = sn_config_get_icon_size (box->config);
+  SnItemState     *state;
+  cairo_surface_t *surface;
+  gboolean         symbolic;
+  gboolean         symbolic_icons;
+  gint             icon_size;
+  gint             scale;
+  gchar           *theme_name = NULL;
+  gboolean         changed = FALSE;
+
+  state = sn_item_get_state (box->item);
   symbolic_icons = sn_config_get_symbolic_icons (box->config);
+  icon_size = sn_config_get_icon_size (box->config);
+  scale = gtk_widget_get_scale_factor (GTK_WIDGET (box));
+  g_object_get (gtk_settings_get_default (), "gtk-theme-name", &theme_name, NULL);
+
+  /* compare the inputs with the ones of the rendered layers,
+   * unchanged layers are neither loaded nor composited again */
+  if (box->state == NULL ||
+      g_strcmp0 (box->state->icon_theme_path, state->icon_theme_path) ||
+      box->icon_size != icon_size || box->scale != scale ||
+      box->symbolic_icons != symbolic_icons ||
+      g_strcmp0 (box->theme_name, theme_name))
+    {
+      update_icon = TRUE;
+      update_overlay = TRUE;
+    }
+  else
+    {
+      if (g_strcmp0 (box->state->icon_name, state->icon_name) ||
+          box->state->icon_surface != state->icon_surface)
+        update_icon = TRUE;
+
+      if (g_strcmp0 (box->state->overlay_icon_name, state->overlay_icon_name) ||
+          box->state->overlay_icon_surface != state->overlay_icon_surface)
+        update_overlay = TRUE;
+    }
+
+  /* the state keeps the surfaces alive, so their pointers stay unique */
+  sn_item_state_ref (state);
+  if (box->state != NULL)
+    sn_item_state_unref (box->state);
+  box->state = state;
+
+  g_free (box->theme_name);
+  box->theme_name = theme_name;
+  box->symbolic_icons = symbolic_icons;
+
+  if (box->icon_size != icon_size || box->scale != scale)
+    {
+      box->icon_size = icon_size;
+      box->scale = scale;
+      box->size_valid = FALSE;
+    }
+
+  if (!update_icon && !update_overlay)
+    return;
 
-  sn_item_get_icon (box->item, &theme_path,
-                    &icon_name, &icon_pixbuf,
-                    &overlay_icon_name, &overlay_icon_pixbuf);
+  sn_icon_box_set_theme_path (box, state->icon_theme_path);
 
-  if (theme_path != NULL)
+  /* the previous image is kept until pending loads finish */
+
+  if (update_icon)
     {
-      icon_theme_from_path = gtk_icon_theme_new ();
-      gtk_icon_theme_prepend_search_path (icon_theme_from_path, theme_path);
+      if (box->icon_cancellable != NULL)
+        {
+          g_cancellable_cancel (box->icon_cancellable);
+          g_clear_object (&box->icon_cancellable);
+        }
+
+      if (sn_icon_box_load_icon (box, FALSE, state->icon_name, state->icon_surface,
+                                 symbolic_icons, &surface, &symbolic))
+        {
+          sn_icon_box_set_layer (box, FALSE, surface, symbolic);
+          changed = TRUE;
+        }
+    }
+
+  if (update_overlay)
+    {
+      if (box->overlay_cancellable != NULL)
+        {
+          g_cancellable_cancel (box->overlay_cancellable);
+          g_clear_object (&box->overlay_cancellable);
+        }
+
+      if (sn_icon_box_load_icon (box, TRUE, state->overlay_icon_name, state->overlay_icon_surface,
+                                 symbolic_icons, &surface, &symbolic))
+        {
+          sn_icon_box_set_layer (box, TRUE, surface, symbolic);
+          changed = TRUE;
+        }
     }
 
-  sn_icon_box_apply_icon (box->icon, icon_theme, icon_theme_from_path,
-                          icon_name, icon_pixbuf, icon_size, symbolic_icons);
-  sn_icon_box_apply_icon (box->overlay, icon_theme, icon_theme_from_path,
-                          overlay_icon_name, overlay_icon_pixbuf, icon_size, symbolic_icons);
+  if (changed)
+    sn_icon_box_composite (box);
+}
+
+
+
+static void
+sn_icon_box_icon_changed (GtkWidget *widget)
+{
+  /* only the layers whose inputs differ are rendered again */
+  sn_icon_box_schedule (XFCE_SN_ICON_BOX (widget), PENDING_CHECK);
+}
+
+
+
+static void
+sn_icon_box_icon_theme_changed (GtkWidget *widget)
+{
+  /* same inputs may resolve to different icons now */
+  sn_icon_box_schedule (XFCE_SN_ICON_BOX (widget), PENDING_FORCE);
+}
+
 
-  if (icon_theme_from_path != NULL)
-    g_object_unref (icon_theme_from_path);
+
+static void
+sn_icon_box_state_changed (GtkWidget   *widget,
+                           SnItemState *state,
+                           guint        changes)
+{
+  if (changes & (SN_ITEM_STATE_THEME_PATH | SN_ITEM_STATE_ICON | SN_ITEM_STATE_OVERLAY))
+    sn_icon_box_update (XFCE_SN_ICON_BOX (widget), FALSE, FALSE);
+}
+
+
+
+static void
+sn_icon_box_style_updated (GtkWidget *widget)
+{
+  SnIconBox *box = XFCE_SN_ICON_BOX (widget);
+
+  GTK_WIDGET_CLASS (sn_icon_box_parent_class)->style_updated (widget);
+
+  /* symbolic icons are colored according to the style */
+  if (box->item != NULL)
+    sn_icon_box_update (box, box->icon_symbolic, box->overlay_symbolic);
 }
 
 
@@ -421,43 +1166,31 @@ sn_icon_box_get_preferred_size (GtkWidget *widget,
                                 gint      *natural_size,
                                 gboolean   horizontal)
 {
-  SnIconBox      *box = XFCE_SN_ICON_BOX (widget);
-  gint            icon_size;
-  GtkRequisition  child_req;
-  GdkPixbuf      *pixbuf1, *pixbuf2;
-
-  icon_size = sn_config_get_icon_size (box->config);
+  SnIconBox *box = XFCE_SN_ICON_BOX (widget);
 
-  pixbuf1 = gtk_image_get_pixbuf (GTK_IMAGE (box->icon));
-  pixbuf2 = gtk_image_get_pixbuf (GTK_IMAGE (box->overlay));
-  if (pixbuf2 != NULL && (pixbuf1 == NULL ||
-      gdk_pixbuf_get_width (pixbuf2) > gdk_pixbuf_get_width (pixbuf1) ||
-      gdk_pixbuf_get_height (pixbuf2) > gdk_pixbuf_get_height (pixbuf1)))
+  /* sizes only change with the composited image, see sn_icon_box_composite */
+  if (!box->size_valid)
     {
-      pixbuf1 = pixbuf2;
-    }
+      box->natural_width = 0;
+      box->natural_height = 0;
 
-  if (box->icon != NULL)
-    gtk_widget_get_preferred_size (box->icon, NULL, &child_req);
+      if (box->surface != NULL)
+        {
+          /* round up to logical pixels */
+          box->natural_width = (cairo_image_surface_get_width (box->surface) + box->scale - 1) / box->scale;
+          box->natural_height = (cairo_image_surface_get_height (box->surface) + box->scale - 1) / box->scale;
+        }
 
-  if (box->overlay != NULL)
-    gtk_widget_get_preferred_size (box->overlay, NULL, &child_req);
+      box->natural_width = MAX (box->natural_width, box->icon_size);
+      box->natural_height = MAX (box->natural_height, box->icon_size);
+      box->size_valid = TRUE;
+    }
 
   if (minimum_size != NULL)
-    *minimum_size = icon_size;
+    *minimum_size = box->icon_size;
 
   if (natural_size != NULL)
-    {
-      *natural_size = 0;
-      if (pixbuf1 != NULL)
-        {
-          if (horizontal)
-            *natural_size = gdk_pixbuf_get_width (pixbuf1);
-          else
-            *natural_size = gdk_pixbuf_get_height (pixbuf1);
-        }
-      *natural_size = MAX (*natural_size, icon_size);
-    }
+    *natural_size = horizontal ? box->natural_width : box->natural_height;
 }
 
 
@@ -486,13 +1219,15 @@ static void
 sn_icon_box_size_allocate (GtkWidget     *widget,
                            GtkAllocation *allocation)
 {
-  SnIconBox *box = XFCE_SN_ICON_BOX (widget);
+  SnIconBox      *box = XFCE_SN_ICON_BOX (widget);
+  GtkRequisition  child_req;
 
   gtk_widget_set_allocation (widget, allocation);
 
-  if (box->icon != NULL)
-    gtk_widget_size_allocate (box->icon, allocation);
-
-  if (box->overlay != NULL)
-    gtk_widget_size_allocate (box->overlay, allocation);
+  if (box->image != NULL)
+    {
+      /* the image must be measured before allocation, its size is known anyway */
+      gtk_widget_get_preferred_size (box->image, NULL, &child_req);
+      gtk_widget_size_allocate (box->image, allocation);
+    }
 }
@@ -0,0 +1,547 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include "sn-icon-cache.h"
+#include "sn-raster-cache.h"
+
+
+
+/* number of decoded icon files kept around */
+#define FILE_CACHE_SIZE 16
+
+/* number of color sets each symbolic icon is kept in */
+#define SYMBOLIC_CACHE_SIZE 4
+
+
+
+typedef struct
+{
+  GtkIconInfo         *icon_info;
+  GdkPixbuf           *pixbuf;
+  gboolean             rendered;
+
+  /* colors -> recolored pixbuf of symbolic icons, NULL if it failed */
+  GHashTable          *symbolic;
+}
+IconEntry;
+
+struct _SnIconRender
+{
+  GtkIconTheme        *icon_theme;
+  gchar               *key;
+  GtkIconInfo         *icon_info;
+  gint                 pixel_size;
+
+  /* symbolic icons only */
+  gchar               *colors;
+  GdkRGBA              rgba[4];
+};
+
+typedef struct
+{
+  gchar               *key;
+  gint64               mtime;
+  goffset              size;
+  GdkPixbuf           *pixbuf;
+
+  /* position in the queue of recently used files */
+  GList               *link;
+}
+FileEntry;
+
+
+
+/* pixel size and path -> FileEntry, the least recently used are at the tail of the queue */
+static GHashTable *sn_icon_cache_files = NULL;
+static GQueue      sn_icon_cache_files_queue = G_QUEUE_INIT;
+
+/* lookups of the theme icon tables and of the file cache */
+static guint sn_icon_cache_icon_hits = 0;
+static guint sn_icon_cache_icon_misses = 0;
+static guint sn_icon_cache_file_hits = 0;
+static guint sn_icon_cache_file_misses = 0;
+
+/* icon infos are not meant to be loaded from several threads at once */
+G_LOCK_DEFINE_STATIC (sn_icon_cache_render);
+
+
+
+static void
+sn_icon_cache_pixbuf_unref (gpointer data)
+{
+  if (data != NULL)
+    g_object_unref (data);
+}
+
+
+
+static void
+sn_icon_cache_icon_entry_free (gpointer data)
+{
+  IconEntry *entry = data;
+
+  if (entry->icon_info != NULL)
+    g_object_unref (entry->icon_info);
+  if (entry->pixbuf != NULL)
+    g_object_unref (entry->pixbuf);
+  g_hash_table_destroy (entry->symbolic);
+  g_free (entry);
+}
+
+
+
+static void
+sn_icon_cache_icons_invalidate (GtkIconTheme *icon_theme,
+                                GHashTable   *icons)
+{
+  g_debug ("Icon theme changed, dropping %u icons (%u hits, %u misses so far)",
+           g_hash_table_size (icons), sn_icon_cache_icon_hits, sn_icon_cache_icon_misses);
+
+  g_hash_table_remove_all (icons);
+}
+
+
+
+static GHashTable *
+sn_icon_cache_get_icons (GtkIconTheme *icon_theme)
+{
+  GHashTable *icons;
+
+  icons = g_object_get_data (G_OBJECT (icon_theme), "sn-icon-cache-icons");
+  if (icons == NULL)
+    {
+      /* the table lives as long as the theme, consumers reload after this handler */
+      icons = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                     g_free, sn_icon_cache_icon_entry_free);
+      g_object_set_data_full (G_OBJECT (icon_theme), "sn-icon-cache-icons",
+                              icons, (GDestroyNotify) g_hash_table_destroy);
+      g_signal_connect (icon_theme, "changed",
+                        G_CALLBACK (sn_icon_cache_icons_invalidate), icons);
+    }
+
+  return icons;
+}
+
+
+
+static GtkIconInfo *
+sn_icon_cache_lookup_icon (GtkIconTheme *icon_theme,
+                           const gchar  *icon_name,
+                           gint          icon_size,
+                           gint          scale,
+                           gboolean      prefer_symbolic)
+{
+  GtkIconInfo *icon_info = NULL;
+  gchar       *symbolic_icon_name;
+  gint         symbolic_icon_size;
+
+  if (prefer_symbolic && strstr (icon_name, "-symbolic") == NULL)
+    {
+      symbolic_icon_name = g_strdup_printf ("%s-symbolic", icon_name);
+
+      symbolic_icon_size = icon_size;
+      if (symbolic_icon_size <= 48)
+        {
+          /* calculate highest bit (e.g. 22 -> 16, 63 -> 32) */
+          symbolic_icon_size |= symbolic_icon_size >> 1;
+          symbolic_icon_size |= symbolic_icon_size >> 2;
+          symbolic_icon_size |= symbolic_icon_size >> 4;
+          symbolic_icon_size |= symbolic_icon_size >> 8;
+          symbolic_icon_size |= symbolic_icon_size >> 16;
+          symbolic_icon_size = symbolic_icon_size - (symbolic_icon_size >> 1);
+        }
+
+      icon_info = gtk_icon_theme_lookup_icon_for_scale (icon_theme,
+                                                        symbolic_icon_name,
+                                                        symbolic_icon_size, scale,
+                                                        GTK_ICON_LOOKUP_FORCE_SIZE);
+      if (icon_info != NULL && !gtk_icon_info_is_symbolic (icon_info))
+        {
+          g_object_unref (icon_info);
+          icon_info = NULL;
+        }
+
+      g_free (symbolic_icon_name);
+    }
+
+  if (icon_info == NULL)
+    {
+      icon_info = gtk_icon_theme_lookup_icon_for_scale (icon_theme,
+                                                        icon_name,
+                                                        icon_size, scale,
+                                                        GTK_ICON_LOOKUP_FORCE_SIZE);
+    }
+
+  return icon_info;
+}
+
+
+
+static gchar *
+sn_icon_cache_get_colors (GtkStyleContext *context,
+                          GdkRGBA         *colors)
+{
+  gchar   *color_strings[5] = { NULL, };
+  gchar   *result;
+  guint    i;
+
+  /* symbolic icons are recolored the same way GTK does it */
+  gtk_style_context_get_color (context, gtk_style_context_get_state (context), &colors[0]);
+  if (!gtk_style_context_lookup_color (context, "success_color", &colors[1]))
+    gdk_rgba_parse (&colors[1], "#4e9a06");
+  if (!gtk_style_context_lookup_color (context, "warning_color", &colors[2]))
+    gdk_rgba_parse (&colors[2], "#f57900");
+  if (!gtk_style_context_lookup_color (context, "error_color", &colors[3]))
+    gdk_rgba_parse (&colors[3], "#cc0000");
+
+  for (i = 0; i < 4; i++)
+    color_strings[i] = gdk_rgba_to_string (&colors[i]);
+
+  result = g_strjoinv (",", color_strings);
+
+  for (i = 0; i < 4; i++)
+    g_free (color_strings[i]);
+
+  return result;
+}
+
+
+
+gboolean
+sn_icon_cache_load_icon (GtkIconTheme     *icon_theme,
+                         GtkStyleContext  *context,
+                         const gchar      *icon_name,
+                         gint              icon_size,
+                         gint              scale,
+                         gboolean          prefer_symbolic,
+                         GdkPixbuf       **pixbuf,
+                         gboolean         *is_symbolic,
+                         SnIconRender    **render)
+{
+  GHashTable  *icons;
+  IconEntry   *entry;
+  GdkRGBA      colors[4];
+  gchar       *color_key = NULL;
+  gpointer     value;
+  gchar       *key;
+
+  g_return_val_if_fail (GTK_IS_ICON_THEME (icon_theme), TRUE);
+  g_return_val_if_fail (icon_name != NULL, TRUE);
+  g_return_val_if_fail (pixbuf != NULL, TRUE);
+  g_return_val_if_fail (is_symbolic != NULL, TRUE);
+  g_return_val_if_fail (render != NULL, TRUE);
+
+  *pixbuf = NULL;
+  *is_symbolic = FALSE;
+  *render = NULL;
+
+  icons = sn_icon_cache_get_icons (icon_theme);
+  key = g_strdup_printf ("%s:%d:%d:%d", icon_name, icon_size, scale, prefer_symbolic);
+
+  entry = g_hash_table_lookup (icons, key);
+  if (entry != NULL)
+    {
+      sn_icon_cache_icon_hits++;
+    }
+  else
+    {
+      sn_icon_cache_icon_misses++;
+
+      /* only the lookup happens here, it works with the theme caches in memory */
+      entry = g_new0 (IconEntry, 1);
+      entry->icon_info = sn_icon_cache_lookup_icon (icon_theme, icon_name,
+                                                    icon_size, scale, prefer_symbolic);
+      entry->rendered = FALSE;
+      entry->symbolic = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, sn_icon_cache_pixbuf_unref);
+
+      /* failed lookups are cached as well until the theme changes,
+       * items with unknown icon names go straight to their pixmaps */
+      g_hash_table_insert (icons, g_strdup (key), entry);
+    }
+
+  if (entry->icon_info == NULL)
+    {
+      g_free (key);
+      return TRUE;
+    }
+
+  *is_symbolic = gtk_icon_info_is_symbolic (entry->icon_info);
+
+  if (*is_symbolic)
+    {
+      /* symbolic icons depend on style colors, they are cached per color set */
+      color_key = sn_icon_cache_get_colors (context, colors);
+      if (g_hash_table_lookup_extended (entry->symbolic, color_key, NULL, &value))
+        {
+          *pixbuf = value != NULL ? g_object_ref (value) : NULL;
+          g_free (color_key);
+          g_free (key);
+          return TRUE;
+        }
+    }
+  else if (entry->rendered)
+    {
+      *pixbuf = entry->pixbuf != NULL ? g_object_ref (entry->pixbuf) : NULL;
+      g_free (key);
+      return TRUE;
+    }
+
+  /* decoding touches the disk, it is left to a worker thread */
+  *render = g_new0 (SnIconRender, 1);
+  (*render)->icon_theme = g_object_ref (icon_theme);
+  (*render)->key = key;
+  (*render)->icon_info = g_object_ref (entry->icon_info);
+  (*render)->pixel_size = icon_size * scale;
+  (*render)->colors = color_key;
+  if (color_key != NULL)
+    memcpy ((*render)->rgba, colors, sizeof (colors));
+
+  return FALSE;
+}
+
+
+
+GdkPixbuf *
+sn_icon_cache_render (SnIconRender *render)
+{
+  const gchar *filename;
+  GStatBuf     st;
+  GdkPixbuf   *pixbuf;
+  gchar       *key = NULL;
+
+  g_return_val_if_fail (render != NULL, NULL);
+
+  /* rasterized icons are shared with other panels and plugin processes */
+  filename = gtk_icon_info_get_filename (render->icon_info);
+  if (filename != NULL && g_stat (filename, &st) == 0)
+    {
+      if (render->colors != NULL)
+        {
+          key = g_strdup_printf ("symbolic:%s:%" G_GINT64_FORMAT ":%d:%s",
+                                 filename, (gint64) st.st_mtime, render->pixel_size, render->colors);
+        }
+      else
+        {
+          key = g_strdup_printf ("icon:%s:%" G_GINT64_FORMAT ":%d",
+                                 filename, (gint64) st.st_mtime, render->pixel_size);
+        }
+
+      pixbuf = sn_raster_cache_lookup (key);
+      if (pixbuf != NULL)
+        {
+          g_free (key);
+          return pixbuf;
+        }
+    }
+
+  G_LOCK (sn_icon_cache_render);
+  if (render->colors != NULL)
+    {
+      /* the same recoloring GTK does for a style context */
+      pixbuf = gtk_icon_info_load_symbolic (render->icon_info,
+                                            &render->rgba[0], &render->rgba[1],
+                                            &render->rgba[2], &render->rgba[3],
+                                            NULL, NULL);
+    }
+  else
+    {
+      pixbuf = gtk_icon_info_load_icon (render->icon_info, NULL);
+    }
+  G_UNLOCK (sn_icon_cache_render);
+
+  if (key != NULL && pixbuf != NULL)
+    sn_raster_cache_store (key, pixbuf);
+
+  g_free (key);
+
+  return pixbuf;
+}
+
+
+
+void
+sn_icon_cache_add_icon (SnIconRender *render,
+                        GdkPixbuf    *pixbuf)
+{
+  GHashTable *icons;
+  IconEntry  *entry;
+
+  g_return_if_fail (render != NULL);
+
+  icons = sn_icon_cache_get_icons (render->icon_theme);
+  entry = g_hash_table_lookup (icons, render->key);
+
+  /* the theme has changed meanwhile, the icon is looked up again */
+  if (entry == NULL || entry->icon_info != render->icon_info)
+    return;
+
+  if (render->colors != NULL)
+    {
+      /* hover, active and backdrop states switch between a few color sets */
+      if (g_hash_table_size (entry->symbolic) >= SYMBOLIC_CACHE_SIZE)
+        g_hash_table_remove_all (entry->symbolic);
+
+      g_hash_table_insert (entry->symbolic, g_strdup (render->colors),
+                           pixbuf != NULL ? g_object_ref (pixbuf) : NULL);
+    }
+  else
+    {
+      if (entry->pixbuf != NULL)
+        g_object_unref (entry->pixbuf);
+      entry->pixbuf = pixbuf != NULL ? g_object_ref (pixbuf) : NULL;
+      entry->rendered = TRUE;
+    }
+}
+
+
+
+void
+sn_icon_cache_render_free (SnIconRender *render)
+{
+  g_return_if_fail (render != NULL);
+
+  g_object_unref (render->icon_info);
+  g_object_unref (render->icon_theme);
+  g_free (render->colors);
+  g_free (render->key);
+  g_free (render);
+}
+
+
+
+static void
+sn_icon_cache_file_entry_free (gpointer data)
+{
+  FileEntry *entry = data;
+
+  if (entry->pixbuf != NULL)
+    g_object_unref (entry->pixbuf);
+  g_free (entry->key);
+  g_free (entry);
+}
+
+
+
+gboolean
+sn_icon_cache_lookup_file (const gchar  *path,
+                           gint          pixel_size,
+                           GdkPixbuf   **pixbuf)
+{
+  FileEntry *entry;
+  GStatBuf   st;
+  gchar     *key;
+
+  g_return_val_if_fail (path != NULL, TRUE);
+  g_return_val_if_fail (pixbuf != NULL, TRUE);
+
+  *pixbuf = NULL;
+
+  if (g_stat (path, &st) != 0 || !S_ISREG (st.st_mode))
+    return TRUE;
+
+  if (sn_icon_cache_files == NULL)
+    return FALSE;
+
+  /* files without a real size are decoded at the pixel size of the box */
+  key = g_strdup_printf ("%d:%s", pixel_size, path);
+  entry = g_hash_table_lookup (sn_icon_cache_files, key);
+  g_free (key);
+
+  if (entry != NULL && entry->mtime == (gint64) st.st_mtime && entry->size == st.st_size)
+    {
+      /* unchanged file, don't decode it again, even if it failed before */
+      sn_icon_cache_file_hits++;
+      g_queue_unlink (&sn_icon_cache_files_queue, entry->link);
+      g_queue_push_head_link (&sn_icon_cache_files_queue, entry->link);
+      if (entry->pixbuf != NULL)
+        *pixbuf = g_object_ref (entry->pixbuf);
+      return TRUE;
+    }
+
+  sn_icon_cache_file_misses++;
+
+  return FALSE;
+}
+
+
+
+void
+sn_icon_cache_add_file (const gchar *path,
+                        gint         pixel_size,
+                        gint64       mtime,
+                        goffset      size,
+                        GdkPixbuf   *pixbuf)
+{
+  FileEntry *entry;
+  gchar     *key;
+
+  g_return_if_fail (path != NULL);
+
+  if (sn_icon_cache_files == NULL)
+    {
+      sn_icon_cache_files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   NULL, sn_icon_cache_file_entry_free);
+    }
+
+  key = g_strdup_printf ("%d:%s", pixel_size, path);
+  entry = g_hash_table_lookup (sn_icon_cache_files, key);
+  if (entry != NULL)
+    {
+      g_queue_delete_link (&sn_icon_cache_files_queue, entry->link);
+      g_hash_table_remove (sn_icon_cache_files, key);
+    }
+
+  entry = g_new0 (FileEntry, 1);
+  entry->key = key;
+  entry->mtime = mtime;
+  entry->size = size;
+  entry->pixbuf = pixbuf != NULL ? g_object_ref (pixbuf) : NULL;
+
+  g_hash_table_insert (sn_icon_cache_files, entry->key, entry);
+  g_queue_push_head (&sn_icon_cache_files_queue, entry);
+  entry->link = sn_icon_cache_files_queue.head;
+
+  /* apps writing a new file for every change would grow the cache forever */
+  while (sn_icon_cache_files_queue.length > FILE_CACHE_SIZE)
+    {
+      g_hash_table_remove (sn_icon_cache_files,
+                           ((FileEntry *) g_queue_pop_tail (&sn_icon_cache_files_queue))->key);
+    }
+}
+
+
+
+void
+sn_icon_cache_dump_stats (void)
+{
+  g_debug ("Icon tables: %u hits, %u misses; file cache: %u hits, %u misses",
+           sn_icon_cache_icon_hits, sn_icon_cache_icon_misses,
+           sn_icon_cache_file_hits, sn_icon_cache_file_misses);
+}
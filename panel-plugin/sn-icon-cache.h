@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SN_ICON_CACHE_H__
+#define __SN_ICON_CACHE_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* a theme icon waiting to be decoded in a worker thread */
+typedef struct _SnIconRender SnIconRender;
+
+gboolean               sn_icon_cache_load_icon                 (GtkIconTheme            *icon_theme,
+                                                                GtkStyleContext         *context,
+                                                                const gchar             *icon_name,
+                                                                gint                     icon_size,
+                                                                gint                     scale,
+                                                                gboolean                 prefer_symbolic,
+                                                                GdkPixbuf              **pixbuf,
+                                                                gboolean                *is_symbolic,
+                                                                SnIconRender           **render);
+
+GdkPixbuf             *sn_icon_cache_render                    (SnIconRender            *render);
+
+void                   sn_icon_cache_add_icon                  (SnIconRender            *render,
+                                                                GdkPixbuf               *pixbuf);
+
+void                   sn_icon_cache_render_free               (SnIconRender            *render);
+
+gboolean               sn_icon_cache_lookup_file               (const gchar             *path,
+                                                                gint                     pixel_size,
+                                                                GdkPixbuf              **pixbuf);
+
+void                   sn_icon_cache_add_file                  (const gchar             *path,
+                                                                gint                     pixel_size,
+                                                                gint64                   mtime,
+                                                                goffset                  size,
+                                                                GdkPixbuf               *pixbuf);
+
+void                   sn_icon_cache_dump_stats                (void);
+
+G_END_DECLS
+
+#endif /* !__SN_ICON_CACHE_H__ */
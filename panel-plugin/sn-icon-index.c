@@ -0,0 +1,525 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <gio/gio.h>
+
+#include "sn-icon-index.h"
+
+
+
+/* private theme directories are shallow, e.g. hicolor/22x22/apps/name.png */
+#define SCAN_MAX_DEPTH 4
+
+#define SIZE_UNKNOWN  -1
+#define SIZE_SCALABLE  0
+
+
+
+static void                  sn_icon_index_finalize                  (GObject                 *object);
+
+static void                  sn_icon_index_monitor_changed           (GFileMonitor            *monitor,
+                                                                      GFile                   *file,
+                                                                      GFile                   *other_file,
+                                                                      GFileMonitorEvent        event_type,
+                                                                      SnIconIndex             *index);
+
+static void                  sn_icon_index_rebuild                   (SnIconIndex             *index);
+
+
+
+struct _SnIconIndexClass
+{
+  GObjectClass         __parent__;
+};
+
+struct _SnIconIndex
+{
+  GObject              __parent__;
+
+  gchar               *path;
+
+  /* every scanned directory is monitored, icons live in subdirectories */
+  GPtrArray           *monitors;
+
+  /* icon name -> GSList of IndexEntry, built in a thread on the first lookup */
+  GHashTable          *icons;
+  gboolean             valid;
+  gboolean             scanning;
+
+  /* changes since the running scan was started */
+  guint                serial;
+
+  /* theme with the path prepended, created on demand for symbolic icons */
+  GtkIconTheme        *icon_theme;
+};
+
+G_DEFINE_TYPE (SnIconIndex, sn_icon_index, G_TYPE_OBJECT)
+
+
+
+typedef struct
+{
+  gchar               *filename;
+  gint                 size;
+}
+IndexEntry;
+
+typedef struct
+{
+  gchar               *path;
+  guint                serial;
+
+  GHashTable          *icons;
+  GPtrArray           *dirs;
+}
+ScanJob;
+
+
+
+enum
+{
+  CHANGED,
+  LAST_SIGNAL
+};
+
+static guint sn_icon_index_signals[LAST_SIGNAL] = { 0, };
+
+
+
+/* search path -> SnIconIndex, indexes are shared by items using the same path */
+static GHashTable *sn_icon_index_instances = NULL;
+
+
+
+static void
+sn_icon_index_class_init (SnIconIndexClass *klass)
+{
+  GObjectClass *object_class;
+
+  object_class = G_OBJECT_CLASS (klass);
+  object_class->finalize = sn_icon_index_finalize;
+
+  sn_icon_index_signals[CHANGED] =
+    g_signal_new (g_intern_static_string ("changed"),
+                  G_TYPE_FROM_CLASS (object_class),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL,
+                  g_cclosure_marshal_VOID__VOID,
+                  G_TYPE_NONE, 0);
+}
+
+
+
+static void
+sn_icon_index_entries_free (gpointer data)
+{
+  GSList     *entries = data;
+  GSList     *li;
+  IndexEntry *entry;
+
+  for (li = entries; li != NULL; li = li->next)
+    {
+      entry = li->data;
+      g_free (entry->filename);
+      g_free (entry);
+    }
+
+  g_slist_free (entries);
+}
+
+
+
+static GHashTable *
+sn_icon_index_icons_new (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal,
+                                g_free, sn_icon_index_entries_free);
+}
+
+
+
+static void
+sn_icon_index_monitor_free (gpointer data)
+{
+  GFileMonitor *monitor = data;
+
+  g_signal_handlers_disconnect_matched (monitor, G_SIGNAL_MATCH_FUNC, 0, 0, NULL,
+                                        (gpointer) sn_icon_index_monitor_changed, NULL);
+  g_file_monitor_cancel (monitor);
+  g_object_unref (monitor);
+}
+
+
+
+static void
+sn_icon_index_init (SnIconIndex *index)
+{
+  index->path = NULL;
+
+  index->monitors = g_ptr_array_new_with_free_func (sn_icon_index_monitor_free);
+
+  index->icons = sn_icon_index_icons_new ();
+  index->valid = FALSE;
+  index->scanning = FALSE;
+
+  index->serial = 0;
+
+  index->icon_theme = NULL;
+}
+
+
+
+static void
+sn_icon_index_finalize (GObject *object)
+{
+  SnIconIndex *index = XFCE_SN_ICON_INDEX (object);
+
+  g_hash_table_remove (sn_icon_index_instances, index->path);
+
+  g_ptr_array_free (index->monitors, TRUE);
+  g_hash_table_destroy (index->icons);
+  g_free (index->path);
+
+  if (index->icon_theme != NULL)
+    g_object_unref (index->icon_theme);
+
+  G_OBJECT_CLASS (sn_icon_index_parent_class)->finalize (object);
+}
+
+
+
+static void
+sn_icon_index_monitor_changed (GFileMonitor      *monitor,
+                               GFile             *file,
+                               GFile             *other_file,
+                               GFileMonitorEvent  event_type,
+                               SnIconIndex       *index)
+{
+  if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    return;
+
+  /* lookups keep waiting for the rebuilt index, a running scan is restarted */
+  index->valid = FALSE;
+  index->serial++;
+
+  if (!index->scanning)
+    sn_icon_index_rebuild (index);
+}
+
+
+
+SnIconIndex *
+sn_icon_index_get (const gchar *path)
+{
+  SnIconIndex *index;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  if (sn_icon_index_instances == NULL)
+    sn_icon_index_instances = g_hash_table_new (g_str_hash, g_str_equal);
+
+  index = g_hash_table_lookup (sn_icon_index_instances, path);
+  if (index != NULL)
+    return g_object_ref (index);
+
+  index = g_object_new (XFCE_TYPE_SN_ICON_INDEX, NULL);
+  index->path = g_strdup (path);
+
+  /* the table doesn't own indexes, users do */
+  g_hash_table_insert (sn_icon_index_instances, index->path, index);
+
+  return index;
+}
+
+
+
+static gint
+sn_icon_index_parse_size (const gchar *dir_name,
+                          gint         parent_size)
+{
+  gint width, height, scale;
+
+  if (g_strcmp0 (dir_name, "scalable") == 0)
+    return SIZE_SCALABLE;
+
+  /* icon theme directories are named like 22x22 or 22x22@2,
+   * sizes are kept in device pixels like lookups use them */
+  if (sscanf (dir_name, "%dx%d@%d", &width, &height, &scale) == 3 && width > 0 && scale > 0)
+    return width * scale;
+
+  if (sscanf (dir_name, "%dx%d", &width, &height) == 2 && width > 0)
+    return width;
+
+  return parent_size;
+}
+
+
+
+static void
+sn_icon_index_scan (ScanJob     *job,
+                    const gchar *dir_path,
+                    gint         size,
+                    gint         depth)
+{
+  GDir        *dir;
+  const gchar *name;
+  const gchar *extension;
+  gchar       *filename;
+  gchar       *icon_name;
+  GSList      *entries;
+  IndexEntry  *entry;
+
+  dir = g_dir_open (dir_path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  g_ptr_array_add (job->dirs, g_strdup (dir_path));
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      filename = g_build_filename (dir_path, name, NULL);
+
+      if (g_file_test (filename, G_FILE_TEST_IS_DIR))
+        {
+          if (depth < SCAN_MAX_DEPTH)
+            sn_icon_index_scan (job, filename, sn_icon_index_parse_size (name, size), depth + 1);
+          g_free (filename);
+          continue;
+        }
+
+      extension = strrchr (name, '.');
+      if (extension == NULL || extension == name ||
+          (g_strcmp0 (extension, ".png") && g_strcmp0 (extension, ".svg") &&
+           g_strcmp0 (extension, ".xpm")))
+        {
+          g_free (filename);
+          continue;
+        }
+
+      icon_name = g_strndup (name, extension - name);
+
+      entry = g_new0 (IndexEntry, 1);
+      entry->filename = filename;
+      entry->size = size;
+
+      /* appending keeps the head of the list owned by the table */
+      entries = g_hash_table_lookup (job->icons, icon_name);
+      if (entries != NULL)
+        {
+          entries = g_slist_append (entries, entry);
+          g_free (icon_name);
+        }
+      else
+        {
+          g_hash_table_insert (job->icons, icon_name, g_slist_append (NULL, entry));
+        }
+    }
+
+  g_dir_close (dir);
+}
+
+
+
+static void
+sn_icon_index_scan_thread (GTask        *task,
+                           gpointer      source_object,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
+{
+  ScanJob *job = task_data;
+
+  sn_icon_index_scan (job, job->path, SIZE_UNKNOWN, 0);
+  g_task_return_boolean (task, TRUE);
+}
+
+
+
+static void
+sn_icon_index_scan_job_free (gpointer data)
+{
+  ScanJob *job = data;
+
+  g_free (job->path);
+  if (job->icons != NULL)
+    g_hash_table_destroy (job->icons);
+  g_ptr_array_free (job->dirs, TRUE);
+  g_free (job);
+}
+
+
+
+static void
+sn_icon_index_scan_finished (GObject      *source_object,
+                             GAsyncResult *res,
+                             gpointer      user_data)
+{
+  SnIconIndex  *index = XFCE_SN_ICON_INDEX (source_object);
+  ScanJob      *job = g_task_get_task_data (G_TASK (res));
+  GFileMonitor *monitor;
+  GFile        *file;
+  guint         n;
+
+  index->scanning = FALSE;
+
+  if (job->serial != index->serial)
+    {
+      /* directories changed while they were scanned */
+      sn_icon_index_rebuild (index);
+      return;
+    }
+
+  g_hash_table_destroy (index->icons);
+  index->icons = job->icons;
+  job->icons = NULL;
+  index->valid = TRUE;
+
+  /* the theme is scanned again when it's needed next time */
+  g_clear_object (&index->icon_theme);
+
+  /* the path might not exist yet, it's monitored for creation then */
+  if (job->dirs->len == 0)
+    g_ptr_array_add (job->dirs, g_strdup (job->path));
+
+  /* new subdirectories are noticed by the monitor of their parent */
+  g_ptr_array_set_size (index->monitors, 0);
+  for (n = 0; n < job->dirs->len; n++)
+    {
+      file = g_file_new_for_path (g_ptr_array_index (job->dirs, n));
+      monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE, NULL, NULL);
+      g_object_unref (file);
+
+      if (monitor != NULL)
+        {
+          g_signal_connect (monitor, "changed",
+                            G_CALLBACK (sn_icon_index_monitor_changed), index);
+          g_ptr_array_add (index->monitors, monitor);
+        }
+    }
+
+  g_debug ("Indexed %u icons in %u directories of %s",
+           g_hash_table_size (index->icons), job->dirs->len, index->path);
+
+  g_signal_emit (G_OBJECT (index), sn_icon_index_signals[CHANGED], 0);
+}
+
+
+
+static void
+sn_icon_index_rebuild (SnIconIndex *index)
+{
+  ScanJob *job;
+  GTask   *task;
+
+  job = g_new0 (ScanJob, 1);
+  job->path = g_strdup (index->path);
+  job->serial = index->serial;
+  job->icons = sn_icon_index_icons_new ();
+  job->dirs = g_ptr_array_new_with_free_func (g_free);
+
+  index->scanning = TRUE;
+
+  task = g_task_new (index, NULL, sn_icon_index_scan_finished, NULL);
+  g_task_set_task_data (task, job, sn_icon_index_scan_job_free);
+  g_task_run_in_thread (task, sn_icon_index_scan_thread);
+  g_object_unref (task);
+}
+
+
+
+gboolean
+sn_icon_index_lookup (SnIconIndex  *index,
+                      const gchar  *icon_name,
+                      gint          size,
+                      const gchar **filename)
+{
+  GSList     *li;
+  IndexEntry *entry;
+  IndexEntry *scalable = NULL;
+  IndexEntry *nearest = NULL;
+  IndexEntry *unknown = NULL;
+
+  g_return_val_if_fail (XFCE_IS_SN_ICON_INDEX (index), FALSE);
+  g_return_val_if_fail (icon_name != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  *filename = NULL;
+
+  if (!index->valid)
+    {
+      /* directories are scanned in a thread, changed is emitted when done */
+      if (!index->scanning)
+        sn_icon_index_rebuild (index);
+      return FALSE;
+    }
+
+  /* the same order as GtkIconTheme: exact size, scalable, closest size */
+  for (li = g_hash_table_lookup (index->icons, icon_name); li != NULL; li = li->next)
+    {
+      entry = li->data;
+
+      if (entry->size == size)
+        {
+          *filename = entry->filename;
+          return TRUE;
+        }
+      else if (entry->size == SIZE_SCALABLE)
+        scalable = entry;
+      else if (entry->size == SIZE_UNKNOWN)
+        unknown = entry;
+      else if (nearest == NULL ||
+               ABS (entry->size - size) < ABS (nearest->size - size) ||
+               (ABS (entry->size - size) == ABS (nearest->size - size) && entry->size > nearest->size))
+        nearest = entry;
+    }
+
+  if (scalable != NULL)
+    *filename = scalable->filename;
+  else if (nearest != NULL)
+    *filename = nearest->filename;
+  else if (unknown != NULL)
+    *filename = unknown->filename;
+
+  return TRUE;
+}
+
+
+
+GtkIconTheme *
+sn_icon_index_get_icon_theme (SnIconIndex *index)
+{
+  g_return_val_if_fail (XFCE_IS_SN_ICON_INDEX (index), NULL);
+
+  /* shared by all items using the path, it scans the directories once */
+  if (index->icon_theme == NULL)
+    {
+      index->icon_theme = gtk_icon_theme_new ();
+      gtk_icon_theme_prepend_search_path (index->icon_theme, index->path);
+    }
+
+  return index->icon_theme;
+}
@@ -0,0 +1,49 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SN_ICON_INDEX_H__
+#define __SN_ICON_INDEX_H__
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SnIconIndexClass SnIconIndexClass;
+typedef struct _SnIconIndex      SnIconIndex;
+
+#define XFCE_TYPE_SN_ICON_INDEX            (sn_icon_index_get_type ())
+#define XFCE_SN_ICON_INDEX(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), XFCE_TYPE_SN_ICON_INDEX, SnIconIndex))
+#define XFCE_SN_ICON_INDEX_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), XFCE_TYPE_SN_ICON_INDEX, SnIconIndexClass))
+#define XFCE_IS_SN_ICON_INDEX(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), XFCE_TYPE_SN_ICON_INDEX))
+#define XFCE_IS_SN_ICON_INDEX_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), XFCE_TYPE_SN_ICON_INDEX))
+#define XFCE_SN_ICON_INDEX_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), XFCE_TYPE_SN_ICON_INDEX, SnIconIndexClass))
+
+GType                  sn_icon_index_get_type                  (void) G_GNUC_CONST;
+
+SnIconIndex           *sn_icon_index_get                       (const gchar             *path);
+
+gboolean               sn_icon_index_lookup                    (SnIconIndex             *index,
+                                                                const gchar             *icon_name,
+                                                                gint                     size,
+                                                                const gchar            **filename);
+
+GtkIconTheme          *sn_icon_index_get_icon_theme            (SnIconIndex             *index);
+
+G_END_DECLS
+
+#endif /* !__SN_ICON_INDEX_H__ */
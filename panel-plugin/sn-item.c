@@ -29,6 +29,16 @@
 #include <libdbusmenu-gtk/dbusmenu-gtk.h>
 
 #include "sn-item.h"
+#include "sn-pixmap.h"
+
+
+
+/* menus which were not used for this time are destroyed */
+#define MENU_CACHE_IDLE_TIME       (10 * G_TIME_SPAN_MINUTE)
+#define MENU_CACHE_CHECK_INTERVAL  60
+
+/* rough heap size of a menu item with its label, image and style nodes */
+#define MENU_ITEM_SIZE_ESTIMATE    (2 * 1024)
 
 
 
@@ -50,10 +60,23 @@ static void                  sn_item_signal_received                 (GDBusProxy
                                                                       GVariant                *parameters,
                                                                       gpointer                 user_data);
 
+static void                  sn_item_properties_signal_received      (GDBusProxy              *proxy,
+                                                                      gchar                   *sender_name,
+                                                                      gchar                   *signal_name,
+                                                                      GVariant                *parameters,
+                                                                      gpointer                 user_data);
+
 static void                  sn_item_get_all_properties_result       (GObject                 *source_object,
                                                                       GAsyncResult            *res,
                                                                       gpointer                 user_data);
 
+static void                  sn_item_update_properties               (SnItem                  *item,
+                                                                      GVariantIter            *iter);
+
+static guint                 sn_item_update_state                    (SnItem                  *item);
+
+static void                  sn_item_latency_dump                    (SnItem                  *item);
+
 
 
 struct _SnItemClass
@@ -72,7 +95,8 @@ struct _SnItem
   GCancellable        *cancellable;
   GDBusProxy          *item_proxy;
   GDBusProxy          *properties_proxy;
-  guint                properties_timeout;
+  /* New* signals whose properties also came in PropertiesChanged */
+  guint                inline_signals;
 
   gchar               *bus_name;
   gchar               *object_path;
@@ -88,14 +112,24 @@ struct _SnItem
   gchar               *icon_name;
   gchar               *attention_icon_name;
   gchar               *overlay_icon_name;
-  GdkPixbuf           *icon_pixbuf;
-  GdkPixbuf           *attention_icon_pixbuf;
-  GdkPixbuf           *overlay_icon_pixbuf;
+  cairo_surface_t     *icon_surface;
+  cairo_surface_t     *attention_icon_surface;
+  GVariant            *attention_icon_pixmap;
+  gboolean             needs_attention;
+  cairo_surface_t     *overlay_icon_surface;
   gchar               *icon_theme_path;
 
   gboolean             item_is_menu;
   gchar               *menu_object_path;
+  SnItemState         *state;
   GtkWidget           *cached_menu;
+  GList               *cached_menu_link;
+  gint64               cached_menu_used;
+  gboolean             cached_menu_evicted;
+
+  guint                latency[SN_ITEM_LATENCY_N_CALLS]
+                              [SN_ITEM_LATENCY_N_STAGES]
+                              [SN_ITEM_LATENCY_BUCKETS];
 };
 
 G_DEFINE_TYPE (SnItem, sn_item, G_TYPE_OBJECT)
@@ -116,14 +150,31 @@ enum
   EXPOSE,
   SEAL,
   FINISH,
-  TOOLTIP_CHANGED,
-  ICON_CHANGED,
-  MENU_CHANGED,
+  INVALIDATE,
+  STATE_CHANGED,
   LAST_SIGNAL
 };
 
 static guint sn_item_signals[LAST_SIGNAL] = { 0, };
 
+enum
+{
+  NEW_TITLE          = 1 << 0,
+  NEW_ICON           = 1 << 1,
+  NEW_ATTENTION_ICON = 1 << 2,
+  NEW_OVERLAY_ICON   = 1 << 3,
+  NEW_TOOLTIP        = 1 << 4
+};
+
+/* items with cached menus, the most recently used come first */
+static GQueue sn_item_menu_cache = G_QUEUE_INIT;
+static guint  sn_item_menu_cache_size = 8;
+static GHashTable *sn_item_menu_cache_sizes = NULL;
+static guint  sn_item_menu_cache_timeout = 0;
+
+/* activation latency is only measured on request, see sn_item_class_init */
+static gboolean sn_item_latency_enabled = FALSE;
+
 
 
 typedef struct
@@ -133,6 +184,14 @@ typedef struct
 }
 SubscriptionContext;
 
+typedef struct
+{
+  SnItem              *item;
+  SnItemLatencyCall    call;
+  gint64               dispatch_time;
+}
+ActivateContext;
+
 
 
 #define free_error_and_return_if_cancelled(error) \
@@ -165,6 +224,9 @@ sn_item_class_init (SnItemClass *klass)
   object_class->get_property = sn_item_get_property;
   object_class->set_property = sn_item_set_property;
 
+  /* per-item histograms are kept and printed with g_debug at finalize */
+  sn_item_latency_enabled = g_getenv ("SN_DEBUG_LATENCY") != NULL;
+
   g_object_class_install_property (object_class,
                                    PROP_BUS_NAME,
                                    g_param_spec_string ("bus-name", NULL, NULL, NULL,
@@ -213,29 +275,21 @@ sn_item_class_init (SnItemClass *klass)
                   g_cclosure_marshal_VOID__VOID,
                   G_TYPE_NONE, 0);
 
-  sn_item_signals[TOOLTIP_CHANGED] =
-    g_signal_new (g_intern_static_string ("tooltip-changed"),
+  sn_item_signals[INVALIDATE] =
+    g_signal_new (g_intern_static_string ("invalidate"),
                   G_TYPE_FROM_CLASS (object_class),
                   G_SIGNAL_RUN_LAST,
                   0, NULL, NULL,
                   g_cclosure_marshal_VOID__VOID,
                   G_TYPE_NONE, 0);
 
-  sn_item_signals[ICON_CHANGED] =
-    g_signal_new (g_intern_static_string ("icon-changed"),
+  sn_item_signals[STATE_CHANGED] =
+    g_signal_new (g_intern_static_string ("state-changed"),
                   G_TYPE_FROM_CLASS (object_class),
                   G_SIGNAL_RUN_LAST,
                   0, NULL, NULL,
-                  g_cclosure_marshal_VOID__VOID,
-                  G_TYPE_NONE, 0);
-
-  sn_item_signals[MENU_CHANGED] =
-    g_signal_new (g_intern_static_string ("menu-changed"),
-                  G_TYPE_FROM_CLASS (object_class),
-                  G_SIGNAL_RUN_LAST,
-                  0, NULL, NULL,
-                  g_cclosure_marshal_VOID__VOID,
-                  G_TYPE_NONE, 0);
+                  g_cclosure_marshal_generic,
+                  G_TYPE_NONE, 2, G_TYPE_POINTER, G_TYPE_UINT);
 }
 
 
@@ -250,7 +304,7 @@ sn_item_init (SnItem *item)
   item->cancellable = g_cancellable_new ();
   item->item_proxy = NULL;
   item->properties_proxy = NULL;
-  item->properties_timeout = 0;
+  item->inline_signals = 0;
 
   item->bus_name = NULL;
   item->object_path = NULL;
@@ -266,16 +320,180 @@ sn_item_init (SnItem *item)
   item->icon_name = NULL;
   item->attention_icon_name = NULL;
   item->overlay_icon_name = NULL;
-  item->icon_pixbuf = NULL;
-  item->attention_icon_pixbuf = NULL;
-  item->overlay_icon_pixbuf = NULL;
+  item->icon_surface = NULL;
+  item->attention_icon_surface = NULL;
+  item->attention_icon_pixmap = NULL;
+  item->needs_attention = FALSE;
+  item->overlay_icon_surface = NULL;
   item->icon_theme_path = NULL;
 
   /* Ubuntu indicators don't support activate action and
      don't provide this option so it's enabled by default. */
   item->item_is_menu = TRUE;
   item->menu_object_path = NULL;
+  item->state = NULL;
   item->cached_menu = NULL;
+  item->cached_menu_link = NULL;
+  item->cached_menu_used = 0;
+  item->cached_menu_evicted = FALSE;
+
+  memset (item->latency, 0, sizeof (item->latency));
+}
+
+
+
+static guint
+sn_item_menu_count_items (GtkWidget *menu)
+{
+  GList     *children, *li;
+  GtkWidget *submenu;
+  guint      count = 0;
+
+  children = gtk_container_get_children (GTK_CONTAINER (menu));
+  for (li = children; li != NULL; li = li->next)
+    {
+      count++;
+      submenu = GTK_IS_MENU_ITEM (li->data)
+                ? gtk_menu_item_get_submenu (GTK_MENU_ITEM (li->data))
+                : NULL;
+      if (submenu != NULL)
+        count += sn_item_menu_count_items (submenu);
+    }
+  g_list_free (children);
+
+  return count;
+}
+
+
+
+static void
+sn_item_menu_cache_drop (SnItem *item)
+{
+  GtkWidget *menu = item->cached_menu;
+
+  if (menu == NULL)
+    return;
+
+  g_queue_delete_link (&sn_item_menu_cache, item->cached_menu_link);
+  item->cached_menu_link = NULL;
+  item->cached_menu = NULL;
+
+  /* attached buttons release the menu in their destroy handler */
+  gtk_widget_destroy (menu);
+  g_object_unref (menu);
+
+  if (sn_item_menu_cache.length == 0 && sn_item_menu_cache_timeout != 0)
+    {
+      g_source_remove (sn_item_menu_cache_timeout);
+      sn_item_menu_cache_timeout = 0;
+    }
+}
+
+
+
+static void
+sn_item_menu_cache_evict (SnItem *item)
+{
+  guint count;
+
+  count = sn_item_menu_count_items (item->cached_menu);
+  g_debug ("Evicting menu of %s with %u items (about %u KiB), idle for %d s, %u menus cached",
+           item->id, count, count * MENU_ITEM_SIZE_ESTIMATE / 1024,
+           (gint) ((g_get_monotonic_time () - item->cached_menu_used) / G_TIME_SPAN_SECOND),
+           sn_item_menu_cache.length);
+
+  sn_item_menu_cache_drop (item);
+
+  /* hovering doesn't build it again, only showing it does */
+  item->cached_menu_evicted = TRUE;
+}
+
+
+
+static void
+sn_item_menu_cache_touch (SnItem *item)
+{
+  item->cached_menu_used = g_get_monotonic_time ();
+
+  g_queue_unlink (&sn_item_menu_cache, item->cached_menu_link);
+  g_queue_push_head_link (&sn_item_menu_cache, item->cached_menu_link);
+}
+
+
+
+static void
+sn_item_menu_cache_trim (void)
+{
+  SnItem *item;
+
+  while (sn_item_menu_cache.length > sn_item_menu_cache_size)
+    {
+      item = g_queue_peek_tail (&sn_item_menu_cache);
+
+      /* never take away a menu which is shown right now */
+      if (gtk_widget_get_visible (item->cached_menu))
+        break;
+
+      sn_item_menu_cache_evict (item);
+    }
+}
+
+
+
+static gboolean
+sn_item_menu_cache_expire (gpointer user_data)
+{
+  SnItem *item;
+  gint64  now;
+
+  now = g_get_monotonic_time ();
+
+  while ((item = g_queue_peek_tail (&sn_item_menu_cache)) != NULL &&
+         now - item->cached_menu_used >= MENU_CACHE_IDLE_TIME)
+    {
+      if (gtk_widget_get_visible (item->cached_menu))
+        sn_item_menu_cache_touch (item);
+      else
+        sn_item_menu_cache_evict (item);
+    }
+
+  if (sn_item_menu_cache.length == 0)
+    {
+      sn_item_menu_cache_timeout = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+
+
+void
+sn_item_set_menu_cache_size (gconstpointer owner,
+                             guint         size)
+{
+  GHashTableIter iter;
+  gpointer       value;
+
+  /* the cache is shared by all plugins of the process,
+   * so the largest limit of them is used, 0 removes the owner's limit */
+  if (sn_item_menu_cache_sizes == NULL)
+    sn_item_menu_cache_sizes = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  if (size > 0)
+    g_hash_table_insert (sn_item_menu_cache_sizes, (gpointer) owner, GUINT_TO_POINTER (size));
+  else
+    g_hash_table_remove (sn_item_menu_cache_sizes, owner);
+
+  if (g_hash_table_size (sn_item_menu_cache_sizes) == 0)
+    return;
+
+  sn_item_menu_cache_size = 1;
+  g_hash_table_iter_init (&iter, sn_item_menu_cache_sizes);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    sn_item_menu_cache_size = MAX (sn_item_menu_cache_size, GPOINTER_TO_UINT (value));
+
+  sn_item_menu_cache_trim ();
 }
 
 
@@ -285,10 +503,10 @@ sn_item_finalize (GObject *object)
 {
   SnItem *item = XFCE_SN_ITEM (object);
 
-  g_object_unref (item->cancellable);
+  if (sn_item_latency_enabled)
+    sn_item_latency_dump (item);
 
-  if (item->properties_timeout != 0)
-    g_source_remove (item->properties_timeout);
+  g_object_unref (item->cancellable);
 
   if (item->properties_proxy != NULL)
     g_object_unref (item->properties_proxy);
@@ -312,16 +530,19 @@ sn_item_finalize (GObject *object)
   g_free (item->overlay_icon_name);
   g_free (item->icon_theme_path);
 
-  if (item->icon_pixbuf != NULL)
-    g_object_unref (item->icon_pixbuf);
-  if (item->attention_icon_pixbuf != NULL)
-    g_object_unref (item->attention_icon_pixbuf);
-  if (item->overlay_icon_pixbuf != NULL)
-    g_object_unref (item->overlay_icon_pixbuf);
+  if (item->icon_surface != NULL)
+    cairo_surface_destroy (item->icon_surface);
+  if (item->attention_icon_surface != NULL)
+    cairo_surface_destroy (item->attention_icon_surface);
+  if (item->attention_icon_pixmap != NULL)
+    g_variant_unref (item->attention_icon_pixmap);
+  if (item->overlay_icon_surface != NULL)
+    cairo_surface_destroy (item->overlay_icon_surface);
 
   g_free (item->menu_object_path);
-  if (item->cached_menu != NULL)
-    gtk_widget_destroy (item->cached_menu);
+  if (item->state != NULL)
+    sn_item_state_unref (item->state);
+  sn_item_menu_cache_drop (item);
 
   G_OBJECT_CLASS (sn_item_parent_class)->finalize (object);
 }
@@ -433,6 +654,9 @@ sn_item_properties_callback (GObject      *source_object,
   free_error_and_return_if_cancelled (error);
   return_and_finish_if_true (item->properties_proxy == NULL);
 
+  g_signal_connect (item->properties_proxy, "g-signal",
+                    G_CALLBACK (sn_item_properties_signal_received), item);
+
   sn_item_invalidate (item);
 }
 
@@ -521,12 +745,23 @@ sn_item_start (SnItem *item)
 
 
 
-static gboolean
-sn_item_perform_invalidate (gpointer user_data)
+void
+sn_item_invalidate (SnItem *item)
 {
-  SnItem *item = user_data;
+  g_return_if_fail (XFCE_IS_SN_ITEM (item));
+  g_return_if_fail (item->properties_proxy != NULL);
+
+  /* the backend debounces updates of all items with a single timer */
+  g_signal_emit (G_OBJECT (item), sn_item_signals[INVALIDATE], 0);
+}
+
 
-  item->properties_timeout = 0;
+
+void
+sn_item_update (SnItem *item)
+{
+  g_return_if_fail (XFCE_IS_SN_ITEM (item));
+  g_return_if_fail (item->properties_proxy != NULL);
 
   g_dbus_proxy_call (item->properties_proxy,
                      "GetAll",
@@ -536,30 +771,22 @@ sn_item_perform_invalidate (gpointer user_data)
                      item->cancellable,
                      sn_item_get_all_properties_result,
                      item);
-
-  return G_SOURCE_REMOVE;
 }
 
 
 
-void
-sn_item_invalidate (SnItem *item)
+static gboolean
+sn_item_status_is_exposed (const gchar *status)
 {
-  g_return_if_fail (XFCE_IS_SN_ITEM (item));
-  g_return_if_fail (item->properties_proxy != NULL);
-
-  /* same approach as in Plasma Workspace */
-  if (item->properties_timeout != 0)
-    g_source_remove (item->properties_timeout);
-  item->properties_timeout = g_timeout_add (10, sn_item_perform_invalidate, item);
+  return !!g_strcmp0 (status, "Passive");
 }
 
 
 
 static gboolean
-sn_item_status_is_exposed (const gchar *status)
+sn_item_status_needs_attention (const gchar *status)
 {
-  return !!g_strcmp0 (status, "Passive");
+  return !g_strcmp0 (status, "NeedsAttention");
 }
 
 
@@ -574,82 +801,66 @@ sn_item_signal_received (GDBusProxy *proxy,
   SnItem   *item = user_data;
   gchar    *status;
   gboolean  exposed;
-
-  if (!g_strcmp0 (signal_name, "NewTitle") ||
-      !g_strcmp0 (signal_name, "NewIcon") ||
-      !g_strcmp0 (signal_name, "NewAttentionIcon") ||
-      !g_strcmp0 (signal_name, "NewOverlayIcon") ||
-      !g_strcmp0 (signal_name, "NewToolTip"))
+  gboolean  needs_attention;
+  guint     changes = 0;
+  guint     new_signal = 0;
+
+  if (!g_strcmp0 (signal_name, "NewTitle"))
+    new_signal = NEW_TITLE;
+  else if (!g_strcmp0 (signal_name, "NewIcon"))
+    new_signal = NEW_ICON;
+  else if (!g_strcmp0 (signal_name, "NewAttentionIcon"))
+    new_signal = NEW_ATTENTION_ICON;
+  else if (!g_strcmp0 (signal_name, "NewOverlayIcon"))
+    new_signal = NEW_OVERLAY_ICON;
+  else if (!g_strcmp0 (signal_name, "NewToolTip"))
+    new_signal = NEW_TOOLTIP;
+
+  if (new_signal != 0)
     {
-      sn_item_invalidate (item);
+      /* PropertiesChanged already delivered the new values of this one */
+      if (!(item->inline_signals & new_signal))
+        sn_item_invalidate (item);
     }
   else if (!g_strcmp0 (signal_name, "NewStatus"))
     {
       g_variant_get (parameters, "(s)", &status);
       exposed = sn_item_status_is_exposed (status);
+      needs_attention = sn_item_status_needs_attention (status);
       g_free (status);
 
+      if (needs_attention != item->needs_attention && item->state != NULL)
+        {
+          /* attention icon is already known, just switch to it */
+          item->needs_attention = needs_attention;
+          changes = sn_item_update_state (item);
+        }
+
       if (exposed != item->exposed)
         {
           item->exposed = exposed;
           if (item->initialized)
             g_signal_emit (G_OBJECT (item), sn_item_signals[exposed ? EXPOSE : SEAL], 0);
         }
+      else if (item->initialized && item->exposed && changes != 0)
+        {
+          g_signal_emit (G_OBJECT (item), sn_item_signals[STATE_CHANGED], 0, item->state, changes);
+        }
     }
 }
 
 
 
-static gboolean
-sn_item_pixbuf_equals (GdkPixbuf *p1,
-                       GdkPixbuf *p2)
-{
-  guchar *p1p, *p2p;
-  guint   p1l, p2l;
-  guint   i;
-
-  if (p1 == p2 || (p1 == NULL && p2 == NULL))
-    return TRUE;
-
-  if ((p1 == NULL) != (p2 == NULL))
-    return FALSE;
-
-  p1p = gdk_pixbuf_get_pixels_with_length (p1, &p1l);
-  p2p = gdk_pixbuf_get_pixels_with_length (p2, &p2l);
-
-  if (p1l != p2l)
-    return FALSE;
-
-  for (i = 0; i < p1l; i++)
-    if (p1p[i] != p2p[i])
-      return FALSE;
-
-  return TRUE;
-}
-
-
-
-static void
-sn_item_free (guchar   *pixels,
-              gpointer  data)
-{
-  g_free (pixels);
-}
-
-
-
-static GdkPixbuf *
-sn_item_extract_pixbuf (GVariant *variant)
+static cairo_surface_t *
+sn_item_extract_surface (GVariant *variant)
 {
-  GVariantIter  *iter;
-  gint           width, height;
-  gint           lwidth = 0, lheight = 0;
-  GVariant      *array_value;
-  gconstpointer  data;
-  guchar        *array = NULL;
-  gsize          size;
-  guchar         alpha;
-  gint           i;
+  GVariantIter    *iter;
+  gint             width, height;
+  gint             lwidth = 0, lheight = 0;
+  GVariant        *array_value;
+  GVariant        *largest = NULL;
+  gsize            size;
+  cairo_surface_t *surface = NULL;
 
   if (variant == NULL)
     return NULL;
@@ -669,39 +880,91 @@ sn_item_extract_pixbuf (GVariant *variant)
           if (size == (gsize)(4 * width * height))
             {
               /* find the largest image */
-              data = g_variant_get_data (array_value);
-              if (data != NULL)
-                {
-                  if (array != NULL)
-                    g_free (array);
-                  array = g_memdup (data, size);
-                  lwidth = width;
-                  lheight = height;
-                }
+              if (largest != NULL)
+                g_variant_unref (largest);
+              largest = g_variant_ref (array_value);
+              lwidth = width;
+              lheight = height;
             }
         }
     }
 
   g_variant_iter_free (iter);
 
-  if (array != NULL)
+  if (largest != NULL)
     {
-      /* argb to rgba */
-      for (i = 0; i < 4 * lwidth * lheight; i += 4)
-        {
-          alpha = array[i];
-          array[i] = array[i + 1];
-          array[i + 1] = array[i + 2];
-          array[i + 2] = array[i + 3];
-          array[i + 3] = alpha;
-        }
+      /* converted once, straight from the message data */
+      if (g_variant_get_data (largest) != NULL)
+        surface = sn_pixmap_surface_new (g_variant_get_data (largest), lwidth, lheight);
+      g_variant_unref (largest);
+    }
+
+  return surface;
+}
+
+
+
+static guint
+sn_item_property_new_signal (const gchar *name)
+{
+  if (!g_strcmp0 (name, "Title"))
+    return NEW_TITLE;
+  else if (!g_strcmp0 (name, "IconName") || !g_strcmp0 (name, "IconPixmap"))
+    return NEW_ICON;
+  else if (!g_strcmp0 (name, "AttentionIconName") || !g_strcmp0 (name, "AttentionIconPixmap") ||
+           !g_strcmp0 (name, "AttentionMovieName"))
+    return NEW_ATTENTION_ICON;
+  else if (!g_strcmp0 (name, "OverlayIconName") || !g_strcmp0 (name, "OverlayIconPixmap"))
+    return NEW_OVERLAY_ICON;
+  else if (!g_strcmp0 (name, "ToolTip"))
+    return NEW_TOOLTIP;
+
+  return 0;
+}
+
+
 
-      return gdk_pixbuf_new_from_data (array, GDK_COLORSPACE_RGB,
-                                       TRUE, 8, lwidth, lheight, 4 * lwidth,
-                                       sn_item_free, NULL);
+static void
+sn_item_properties_signal_received (GDBusProxy *proxy,
+                                    gchar      *sender_name,
+                                    gchar      *signal_name,
+                                    GVariant   *parameters,
+                                    gpointer    user_data)
+{
+  SnItem        *item = user_data;
+  const gchar   *interface_name;
+  GVariant      *properties;
+  GVariantIter  *iter;
+  const gchar   *name;
+  GVariant      *value;
+  const gchar  **invalidated;
+
+  if (g_strcmp0 (signal_name, "PropertiesChanged") ||
+      !g_variant_check_format_string (parameters, "(sa{sv}as)", FALSE))
+    return;
+
+  g_variant_get (parameters, "(&s@a{sv}^a&s)", &interface_name, &properties, &invalidated);
+
+  if (!g_strcmp0 (interface_name, "org.kde.StatusNotifierItem"))
+    {
+      /* properties sent inline make their New* signal redundant,
+       * the others are still fetched when their signal arrives */
+      iter = g_variant_iter_new (properties);
+      while (g_variant_iter_loop (iter, "{&sv}", &name, &value))
+        item->inline_signals |= sn_item_property_new_signal (name);
+      g_variant_iter_free (iter);
+
+      iter = g_variant_iter_new (properties);
+      sn_item_update_properties (item, iter);
+      g_variant_iter_free (iter);
+
+      /* values of invalidated properties are not included in the signal */
+      if (invalidated != NULL && invalidated[0] != NULL)
+        sn_item_invalidate (item);
     }
 
-  return NULL;
+  g_variant_unref (properties);
+  g_free (invalidated);
 }
 
 
@@ -715,6 +978,250 @@ sn_item_get_all_properties_result (GObject      *source_object,
   GError       *error = NULL;
   GVariant     *properties;
   GVariantIter *iter = NULL;
+
+  properties = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+  free_error_and_return_if_cancelled (error);
+  return_and_finish_if_true (properties == NULL);
+
+  if (g_variant_check_format_string (properties, "(a{sv})", FALSE) == FALSE)
+    {
+      g_warning ("Could not parse properties for StatusNotifierItem.");
+      g_variant_unref (properties);
+      return;
+    }
+
+  g_variant_get (properties, "(a{sv})", &iter);
+  sn_item_update_properties (item, iter);
+  g_variant_iter_free (iter);
+  g_variant_unref (properties);
+}
+
+
+
+static void
+sn_item_state_resolve_tooltip (SnItem       *item,
+                               const gchar **title,
+                               const gchar **subtitle)
+{
+  #define sn_subtitle(subtitle) (g_strcmp0 (subtitle, *title) ? subtitle : NULL)
+
+  if (item->tooltip_title != NULL && item->tooltip_subtitle != NULL)
+    {
+      *title = item->tooltip_title;
+      *subtitle = sn_subtitle (item->tooltip_subtitle);
+    }
+  else if (item->attention_desc != NULL)
+    {
+      /* try to use attention_desc as subtitle */
+      if (item->tooltip_title != NULL)
+        {
+          *title = item->tooltip_title;
+          *subtitle = sn_subtitle (item->attention_desc);
+        }
+      else if (item->title != NULL)
+        {
+          *title = item->title;
+          *subtitle = sn_subtitle (item->attention_desc);
+        }
+      else
+        {
+          *title = item->attention_desc;
+          *subtitle = NULL;
+        }
+    }
+  else if (item->icon_desc != NULL)
+    {
+      /* try to use icon_desc as subtitle */
+      if (item->tooltip_title != NULL)
+        {
+          *title = item->tooltip_title;
+          *subtitle = sn_subtitle (item->icon_desc);
+        }
+      else if (item->title != NULL)
+        {
+          *title = item->title;
+          *subtitle = sn_subtitle (item->icon_desc);
+        }
+      else
+        {
+          *title = item->icon_desc;
+          *subtitle = NULL;
+        }
+    }
+  else if (item->tooltip_title != NULL )
+    {
+      *title = item->tooltip_title;
+      *subtitle = NULL;
+    }
+  else if (item->title != NULL )
+    {
+      *title = item->title;
+      *subtitle = NULL;
+    }
+  else
+    {
+      *title = NULL;
+      *subtitle = NULL;
+    }
+
+  #undef sn_subtitle
+}
+
+
+
+static SnItemState *
+sn_item_state_new (SnItem *item)
+{
+  SnItemState *state;
+  const gchar     *title, *subtitle;
+  cairo_surface_t *surface;
+
+  state = g_new0 (SnItemState, 1);
+  state->ref_count = 1;
+
+  sn_item_state_resolve_tooltip (item, &title, &subtitle);
+  state->tooltip_title = g_strdup (title);
+  state->tooltip_subtitle = g_strdup (subtitle);
+
+  state->icon_theme_path = g_strdup (item->icon_theme_path);
+
+  /* attention icon is only shown while the item needs attention */
+  state->icon_name = g_strdup (item->needs_attention && item->attention_icon_name != NULL
+                               ? item->attention_icon_name
+                               : item->icon_name);
+  surface = item->needs_attention && item->attention_icon_surface != NULL
+            ? item->attention_icon_surface
+            : item->icon_surface;
+  state->icon_surface = surface != NULL ? cairo_surface_reference (surface) : NULL;
+
+  state->overlay_icon_name = g_strdup (item->overlay_icon_name);
+  surface = item->overlay_icon_surface;
+  state->overlay_icon_surface = surface != NULL ? cairo_surface_reference (surface) : NULL;
+
+  state->item_is_menu = item->item_is_menu;
+  state->menu_object_path = g_strdup (item->menu_object_path);
+
+  return state;
+}
+
+
+
+static guint
+sn_item_state_compare (SnItemState *old_state,
+                       SnItemState *new_state)
+{
+  guint changes = 0;
+
+  if (old_state == NULL)
+    {
+      return SN_ITEM_STATE_TOOLTIP | SN_ITEM_STATE_THEME_PATH |
+             SN_ITEM_STATE_ICON | SN_ITEM_STATE_OVERLAY | SN_ITEM_STATE_MENU;
+    }
+
+  /* surfaces are replaced only when their contents change, so compare pointers */
+
+  if (g_strcmp0 (old_state->tooltip_title, new_state->tooltip_title) ||
+      g_strcmp0 (old_state->tooltip_subtitle, new_state->tooltip_subtitle))
+    changes |= SN_ITEM_STATE_TOOLTIP;
+
+  if (g_strcmp0 (old_state->icon_theme_path, new_state->icon_theme_path))
+    changes |= SN_ITEM_STATE_THEME_PATH;
+
+  if (g_strcmp0 (old_state->icon_name, new_state->icon_name) ||
+      old_state->icon_surface != new_state->icon_surface)
+    changes |= SN_ITEM_STATE_ICON;
+
+  if (g_strcmp0 (old_state->overlay_icon_name, new_state->overlay_icon_name) ||
+      old_state->overlay_icon_surface != new_state->overlay_icon_surface)
+    changes |= SN_ITEM_STATE_OVERLAY;
+
+  if (old_state->item_is_menu != new_state->item_is_menu ||
+      g_strcmp0 (old_state->menu_object_path, new_state->menu_object_path))
+    changes |= SN_ITEM_STATE_MENU;
+
+  return changes;
+}
+
+
+
+SnItemState *
+sn_item_state_ref (SnItemState *state)
+{
+  g_return_val_if_fail (state != NULL, NULL);
+
+  g_atomic_int_inc (&state->ref_count);
+
+  return state;
+}
+
+
+
+void
+sn_item_state_unref (SnItemState *state)
+{
+  g_return_if_fail (state != NULL);
+
+  if (!g_atomic_int_dec_and_test (&state->ref_count))
+    return;
+
+  g_free (state->tooltip_title);
+  g_free (state->tooltip_subtitle);
+  g_free (state->icon_theme_path);
+  g_free (state->icon_name);
+  if (state->icon_surface != NULL)
+    cairo_surface_destroy (state->icon_surface);
+  g_free (state->overlay_icon_name);
+  if (state->overlay_icon_surface != NULL)
+    cairo_surface_destroy (state->overlay_icon_surface);
+  g_free (state->menu_object_path);
+
+  g_free (state);
+}
+
+
+
+static guint
+sn_item_update_state (SnItem *item)
+{
+  SnItemState *state;
+  guint        changes;
+  gboolean     menu_changed;
+
+  if (item->needs_attention)
+    {
+      if (item->attention_icon_surface == NULL && item->attention_icon_pixmap != NULL)
+        item->attention_icon_surface = sn_item_extract_surface (item->attention_icon_pixmap);
+    }
+  else if (item->attention_icon_surface != NULL)
+    {
+      cairo_surface_destroy (item->attention_icon_surface);
+      item->attention_icon_surface = NULL;
+    }
+
+  /* publish a new snapshot, consumers may still hold the old one */
+  state = sn_item_state_new (item);
+  changes = sn_item_state_compare (item->state, state);
+
+  /* the cached menu only belongs to its object path, not to item_is_menu */
+  menu_changed = item->state != NULL &&
+                 g_strcmp0 (item->state->menu_object_path, state->menu_object_path) != 0;
+
+  if (item->state != NULL)
+    sn_item_state_unref (item->state);
+  item->state = state;
+
+  if (menu_changed)
+    sn_item_menu_cache_drop (item);
+
+  return changes;
+}
+
+
+
+static void
+sn_item_update_properties (SnItem       *item,
+                           GVariantIter *iter)
+{
   const gchar  *name;
   GVariant     *value;
 
@@ -722,16 +1229,11 @@ sn_item_get_all_properties_result (GObject      *source_object,
   gchar        *str_val1;
   gchar        *str_val2;
   gboolean      bool_val1;
-  GdkPixbuf    *pb_val1;
+  cairo_surface_t *sf_val1;
 
   gboolean      update_exposed = FALSE;
-  gboolean      update_tooltip = FALSE;
-  gboolean      update_icon = FALSE;
-  gboolean      update_menu = FALSE;
-
-  properties = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
-  free_error_and_return_if_cancelled (error);
-  return_and_finish_if_true (properties == NULL);
+  gboolean      update_state = FALSE;
+  guint         changes = 0;
 
   #define string_empty_null(s) ((s) != NULL ? (s) : "")
 
@@ -745,25 +1247,18 @@ sn_item_get_all_properties_result (GObject      *source_object,
       update_what = TRUE; \
     }
 
-  #define update_new_pixbuf(val, entry, update_what) \
-  if (!sn_item_pixbuf_equals (val, item->entry)) \
+  #define update_new_surface(val, entry, update_what) \
+  if (!sn_pixmap_surface_equal (val, item->entry)) \
     { \
       if (item->entry != NULL) \
-        g_object_unref (item->entry); \
+        cairo_surface_destroy (item->entry); \
       item->entry = val; \
       update_what = TRUE; \
     } \
   else if (val != NULL) \
     { \
-      g_object_unref (val); \
-    }
-
-  if (g_variant_check_format_string (properties, "(a{sv})", FALSE) == FALSE)
-    {
-      g_warning ("Could not parse properties for StatusNotifierItem.");
-      return;
+      cairo_surface_destroy (val); \
     }
-  g_variant_get (properties, "(a{sv})", &iter);
 
   while (g_variant_iter_loop (iter, "{&sv}", &name, &value)) {
     if (!g_strcmp0 (name, "Id"))
@@ -780,11 +1275,17 @@ sn_item_get_all_properties_result (GObject      *source_object,
             item->exposed = bool_val1;
             update_exposed = TRUE;
           }
+        bool_val1 = sn_item_status_needs_attention (cstr_val1);
+        if (bool_val1 != item->needs_attention)
+          {
+            item->needs_attention = bool_val1;
+            update_state = TRUE;
+          }
       }
     else if (!g_strcmp0 (name, "Title"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, title, update_tooltip);
+        update_new_string (cstr_val1, title, update_state);
       }
     else if (!g_strcmp0 (name, "ToolTip"))
       {
@@ -792,21 +1293,21 @@ sn_item_get_all_properties_result (GObject      *source_object,
         if (!g_strcmp0 (cstr_val1, "(sa(iiay)ss)"))
           {
             g_variant_get (value, "(sa(iiay)ss)", NULL, NULL, &str_val1, &str_val2);
-            update_new_string (str_val1, tooltip_title, update_tooltip);
-            update_new_string (str_val2, tooltip_subtitle, update_tooltip);
+            update_new_string (str_val1, tooltip_title, update_state);
+            update_new_string (str_val2, tooltip_subtitle, update_state);
             g_free (str_val1);
             g_free (str_val2);
           }
         else if (!g_strcmp0 (cstr_val1, "s"))
           {
             cstr_val1 = g_variant_get_string (value, NULL);
-            update_new_string (cstr_val1, tooltip_title, update_tooltip);
-            update_new_string (NULL, tooltip_subtitle, update_tooltip);
+            update_new_string (cstr_val1, tooltip_title, update_state);
+            update_new_string (NULL, tooltip_subtitle, update_state);
           }
         else
           {
-            update_new_string (NULL, tooltip_title, update_tooltip);
-            update_new_string (NULL, tooltip_subtitle, update_tooltip);
+            update_new_string (NULL, tooltip_title, update_state);
+            update_new_string (NULL, tooltip_subtitle, update_state);
           }
       }
     else if (!g_strcmp0 (name, "ItemIsMenu"))
@@ -815,68 +1316,80 @@ sn_item_get_all_properties_result (GObject      *source_object,
         if (bool_val1 != item->item_is_menu)
           {
             item->item_is_menu = bool_val1;
-            update_menu = TRUE;
+            update_state = TRUE;
           }
       }
     else if (!g_strcmp0 (name, "Menu"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, menu_object_path, update_menu);
+        update_new_string (cstr_val1, menu_object_path, update_state);
       }
     else if (!g_strcmp0 (name, "IconThemePath"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, icon_theme_path, update_icon);
+        update_new_string (cstr_val1, icon_theme_path, update_state);
       }
     else if (!g_strcmp0 (name, "IconName"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, icon_name, update_icon);
+        update_new_string (cstr_val1, icon_name, update_state);
       }
     else if (!g_strcmp0 (name, "IconPixmap"))
       {
-        pb_val1 = sn_item_extract_pixbuf (value);
-        update_new_pixbuf (pb_val1, icon_pixbuf, update_icon);
+        sf_val1 = sn_item_extract_surface (value);
+        update_new_surface (sf_val1, icon_surface, update_state);
       }
     else if (!g_strcmp0 (name, "IconAccessibleDesc"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, icon_desc, update_tooltip);
+        update_new_string (cstr_val1, icon_desc, update_state);
       }
     else if (!g_strcmp0 (name, "AttentionIconName"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, attention_icon_name, update_icon);
+        update_new_string (cstr_val1, attention_icon_name, update_state);
       }
     else if (!g_strcmp0 (name, "AttentionIconPixmap"))
       {
-        pb_val1 = sn_item_extract_pixbuf (value);
-        update_new_pixbuf (pb_val1, attention_icon_pixbuf, update_icon);
+        /* keep raw data, it's only decoded while the item needs attention */
+        if (item->attention_icon_pixmap == NULL ||
+            !g_variant_equal (value, item->attention_icon_pixmap))
+          {
+            if (item->attention_icon_pixmap != NULL)
+              g_variant_unref (item->attention_icon_pixmap);
+            item->attention_icon_pixmap = g_variant_ref (value);
+            if (item->attention_icon_surface != NULL)
+              {
+                cairo_surface_destroy (item->attention_icon_surface);
+                item->attention_icon_surface = NULL;
+              }
+            update_state = TRUE;
+          }
       }
     else if (!g_strcmp0 (name, "AttentionAccessibleDesc"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, attention_desc, update_tooltip);
+        update_new_string (cstr_val1, attention_desc, update_state);
       }
     else if (!g_strcmp0 (name, "OverlayIconName"))
       {
         cstr_val1 = g_variant_get_string (value, NULL);
-        update_new_string (cstr_val1, overlay_icon_name, update_icon);
+        update_new_string (cstr_val1, overlay_icon_name, update_state);
       }
     else if (!g_strcmp0 (name, "OverlayIconPixmap"))
       {
-        pb_val1 = sn_item_extract_pixbuf (value);
-        update_new_pixbuf (pb_val1, overlay_icon_pixbuf, update_icon);
+        sf_val1 = sn_item_extract_surface (value);
+        update_new_surface (sf_val1, overlay_icon_surface, update_state);
       }
   }
 
-  g_variant_iter_free (iter);
-  g_variant_unref (properties);
-
-  #undef update_new_pixbuf
+  #undef update_new_surface
   #undef update_new_string
   #undef string_empty_null
 
+  if (update_state || item->state == NULL)
+    changes = sn_item_update_state (item);
+
   if (!item->initialized)
     {
       if (item->id != NULL)
@@ -891,20 +1404,8 @@ sn_item_get_all_properties_result (GObject      *source_object,
       if (update_exposed)
         g_signal_emit (G_OBJECT (item), sn_item_signals[item->exposed ? EXPOSE : SEAL], 0);
 
-      if (item->exposed)
-        {
-          if (update_tooltip)
-            g_signal_emit (G_OBJECT (item), sn_item_signals[TOOLTIP_CHANGED], 0);
-          if (update_icon)
-            g_signal_emit (G_OBJECT (item), sn_item_signals[ICON_CHANGED], 0);
-          if (update_menu)
-            {
-              if (item != NULL)
-                g_object_unref (item->cached_menu);
-              item->cached_menu = NULL;
-              g_signal_emit (G_OBJECT (item), sn_item_signals[MENU_CHANGED], 0);
-            }
-        }
+      if (item->exposed && changes != 0)
+        g_signal_emit (G_OBJECT (item), sn_item_signals[STATE_CHANGED], 0, item->state, changes);
     }
 }
 
@@ -921,154 +1422,205 @@ sn_item_get_name (SnItem *item)
 
 
 
-void
-sn_item_get_icon (SnItem       *item,
-                  const gchar **theme_path,
-                  const gchar **icon_name,
-                  GdkPixbuf   **icon_pixbuf,
-                  const gchar **overlay_icon_name,
-                  GdkPixbuf   **overlay_icon_pixbuf)
+SnItemState *
+sn_item_get_state (SnItem *item)
 {
-  g_return_if_fail (XFCE_IS_SN_ITEM (item));
-  g_return_if_fail (item->initialized);
+  g_return_val_if_fail (XFCE_IS_SN_ITEM (item), NULL);
+  g_return_val_if_fail (item->initialized, NULL);
 
-  if (icon_name != NULL)
-    {
-      *icon_name = item->attention_icon_name != NULL
-                   ? item->attention_icon_name
-                   : item->icon_name;
-    }
+  return item->state;
+}
 
-  if (icon_pixbuf != NULL)
-    {
-      *icon_pixbuf = item->attention_icon_pixbuf != NULL
-                   ? item->attention_icon_pixbuf
-                   : item->icon_pixbuf;
-    }
 
-  if (overlay_icon_name != NULL)
-    *overlay_icon_name = item->overlay_icon_name;
 
-  if (overlay_icon_pixbuf != NULL)
-    *overlay_icon_pixbuf = item->overlay_icon_pixbuf;
+gboolean
+sn_item_is_menu_only (SnItem *item)
+{
+  g_return_val_if_fail (XFCE_IS_SN_ITEM (item), FALSE);
+  g_return_val_if_fail (item->initialized, FALSE);
 
-  if (theme_path != NULL)
-    *theme_path = item->icon_theme_path;
+  return item->state->item_is_menu;
 }
 
 
 
-void
-sn_item_get_tooltip (SnItem       *item,
-                     const gchar **title,
-                     const gchar **subtitle)
+gboolean
+sn_item_has_evicted_menu (SnItem *item)
 {
-  gchar *stub;
+  g_return_val_if_fail (XFCE_IS_SN_ITEM (item), FALSE);
 
-  g_return_if_fail (XFCE_IS_SN_ITEM (item));
-  g_return_if_fail (item->initialized);
+  return item->cached_menu_evicted;
+}
 
-  if (title == NULL)
-    title = (gpointer)&stub;
-  if (subtitle == NULL)
-    subtitle = (gpointer)&stub;
 
-  #define sn_subtitle(subtitle) (g_strcmp0 (subtitle, *title) ? subtitle : NULL)
 
-  if (item->tooltip_title != NULL && item->tooltip_subtitle != NULL)
-    {
-      *title = item->tooltip_title;
-      *subtitle = sn_subtitle (item->tooltip_subtitle);
-    }
-  else if (item->attention_desc != NULL)
+GtkWidget *
+sn_item_get_menu (SnItem *item)
+{
+  DbusmenuGtkMenu *menu;
+
+  g_return_val_if_fail (XFCE_IS_SN_ITEM (item), NULL);
+  g_return_val_if_fail (item->initialized, NULL);
+
+  if (item->cached_menu != NULL)
     {
-      /* try to use attention_desc as subtitle */
-      if (item->tooltip_title != NULL)
-        {
-          *title = item->tooltip_title;
-          *subtitle = sn_subtitle (item->attention_desc);
-        }
-      else if (item->title != NULL)
-        {
-          *title = item->title;
-          *subtitle = sn_subtitle (item->attention_desc);
-        }
-      else
-        {
-          *title = item->attention_desc;
-          *subtitle = NULL;
-        }
+      sn_item_menu_cache_touch (item);
     }
-  else if (item->icon_desc != NULL)
+  else if (item->menu_object_path != NULL)
     {
-      /* try to use icon_desc as subtitle */
-      if (item->tooltip_title != NULL)
-        {
-          *title = item->tooltip_title;
-          *subtitle = sn_subtitle (item->icon_desc);
-        }
-      else if (item->title != NULL)
-        {
-          *title = item->title;
-          *subtitle = sn_subtitle (item->icon_desc);
-        }
-      else
+      menu = dbusmenu_gtkmenu_new (item->bus_name, item->menu_object_path);
+      if (menu != NULL)
         {
-          *title = item->icon_desc;
-          *subtitle = NULL;
+          g_object_ref_sink (menu);
+          item->cached_menu = GTK_WIDGET (menu);
+          item->cached_menu_used = g_get_monotonic_time ();
+          item->cached_menu_evicted = FALSE;
+
+          g_queue_push_head (&sn_item_menu_cache, item);
+          item->cached_menu_link = sn_item_menu_cache.head;
+          sn_item_menu_cache_trim ();
+
+          if (sn_item_menu_cache_timeout == 0)
+            {
+              sn_item_menu_cache_timeout =
+                g_timeout_add_seconds (MENU_CACHE_CHECK_INTERVAL,
+                                       sn_item_menu_cache_expire, NULL);
+            }
         }
     }
-  else if (item->tooltip_title != NULL )
-    {
-      *title = item->tooltip_title;
-      *subtitle = NULL;
-    }
-  else if (item->title != NULL )
+
+  return item->cached_menu;
+}
+
+
+
+static void
+sn_item_latency_add (SnItem             *item,
+                     SnItemLatencyCall   call,
+                     SnItemLatencyStage  stage,
+                     gint64              latency)
+{
+  guint bucket = 0;
+
+  while (latency >= 2 && bucket < SN_ITEM_LATENCY_BUCKETS - 1)
     {
-      *title = item->title;
-      *subtitle = NULL;
+      latency >>= 1;
+      bucket++;
     }
-  else
+
+  item->latency[call][stage][bucket]++;
+}
+
+
+
+static void
+sn_item_latency_dump (SnItem *item)
+{
+  GString *string;
+  guint    call, stage, bucket;
+  guint    count;
+
+  string = g_string_new (NULL);
+
+  for (call = 0; call < SN_ITEM_LATENCY_N_CALLS; call++)
     {
-      *title = NULL;
-      *subtitle = NULL;
+      count = 0;
+      for (bucket = 0; bucket < SN_ITEM_LATENCY_BUCKETS; bucket++)
+        count += item->latency[call][SN_ITEM_LATENCY_REPLY][bucket];
+      if (count == 0)
+        continue;
+
+      g_string_append_printf (string, "\n  %s, %u calls",
+                              call == SN_ITEM_LATENCY_ACTIVATE ? "Activate" : "SecondaryActivate",
+                              count);
+
+      for (stage = 0; stage < SN_ITEM_LATENCY_N_STAGES; stage++)
+        {
+          g_string_append (string, stage == SN_ITEM_LATENCY_DISPATCH ? "\n    dispatch:" : "\n    reply:");
+          for (bucket = 0; bucket < SN_ITEM_LATENCY_BUCKETS; bucket++)
+            {
+              /* buckets are named after their lower bound */
+              if (item->latency[call][stage][bucket] > 0)
+                g_string_append_printf (string, " %s%u us: %u",
+                                        bucket == SN_ITEM_LATENCY_BUCKETS - 1 ? ">=" : "",
+                                        bucket > 0 ? 1u << bucket : 0,
+                                        item->latency[call][stage][bucket]);
+            }
+        }
     }
 
-  #undef sn_subtitle
+  if (string->len > 0)
+    g_debug ("%s: activation latency histogram (bucket: count)%s", item->id, string->str);
+
+  g_string_free (string, TRUE);
 }
 
 
 
-gboolean
-sn_item_is_menu_only (SnItem *item)
+static void
+sn_item_activate_result (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
 {
-  g_return_val_if_fail (XFCE_IS_SN_ITEM (item), FALSE);
-  g_return_val_if_fail (item->initialized, FALSE);
+  ActivateContext *context = user_data;
+  GVariant        *result;
+  GError          *error = NULL;
+
+  result = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+
+  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      /* error replies are timed as well, some items don't implement activation */
+      sn_item_latency_add (context->item, context->call, SN_ITEM_LATENCY_REPLY,
+                           g_get_monotonic_time () - context->dispatch_time);
+    }
 
-  return item->item_is_menu;
+  if (result != NULL)
+    g_variant_unref (result);
+  if (error != NULL)
+    g_error_free (error);
+
+  g_object_unref (context->item);
+  g_free (context);
 }
 
 
 
-GtkWidget *
-sn_item_get_menu (SnItem *item)
+static void
+sn_item_activate_call (SnItem            *item,
+                       SnItemLatencyCall  call,
+                       const gchar       *method,
+                       gint               x_root,
+                       gint               y_root,
+                       gint64             input_time)
 {
-  DbusmenuGtkMenu *menu;
+  ActivateContext *context;
 
-  g_return_val_if_fail (XFCE_IS_SN_ITEM (item), NULL);
-  g_return_val_if_fail (item->initialized, NULL);
-
-  if (item->cached_menu == NULL && item->menu_object_path != NULL)
+  if (!sn_item_latency_enabled)
     {
-      menu = dbusmenu_gtkmenu_new (item->bus_name, item->menu_object_path);
-      if (menu != NULL)
-        {
-          g_object_ref_sink (menu);
-          item->cached_menu = GTK_WIDGET (menu);
-        }
+      g_dbus_proxy_call (item->item_proxy, method,
+                         g_variant_new ("(ii)", x_root, y_root),
+                         G_DBUS_CALL_FLAGS_NONE,
+                         -1, NULL, NULL, NULL);
+      return;
     }
 
-  return item->cached_menu;
+  context = g_new0 (ActivateContext, 1);
+  context->item = g_object_ref (item);
+  context->call = call;
+
+  g_dbus_proxy_call (item->item_proxy, method,
+                     g_variant_new ("(ii)", x_root, y_root),
+                     G_DBUS_CALL_FLAGS_NONE,
+                     -1, item->cancellable,
+                     sn_item_activate_result, context);
+
+  context->dispatch_time = g_get_monotonic_time ();
+  if (input_time > 0)
+    {
+      sn_item_latency_add (item, call, SN_ITEM_LATENCY_DISPATCH,
+                           MAX (context->dispatch_time - input_time, 0));
+    }
 }
 
 
@@ -1076,16 +1628,15 @@ sn_item_get_menu (SnItem *item)
 void
 sn_item_activate (SnItem *item,
                   gint    x_root,
-                  gint    y_root)
+                  gint    y_root,
+                  gint64  input_time)
 {
   g_return_if_fail (XFCE_IS_SN_ITEM (item));
   g_return_if_fail (item->initialized);
   g_return_if_fail (item->item_proxy != NULL);
 
-  g_dbus_proxy_call (item->item_proxy, "Activate",
-                     g_variant_new ("(ii)", x_root, y_root),
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1, NULL, NULL, NULL);
+  sn_item_activate_call (item, SN_ITEM_LATENCY_ACTIVATE, "Activate",
+                         x_root, y_root, input_time);
 }
 
 
@@ -1093,16 +1644,32 @@ sn_item_activate (SnItem *item,
 void
 sn_item_secondary_activate (SnItem *item,
                             gint    x_root,
-                            gint    y_root)
+                            gint    y_root,
+                            gint64  input_time)
 {
   g_return_if_fail (XFCE_IS_SN_ITEM (item));
   g_return_if_fail (item->initialized);
   g_return_if_fail (item->item_proxy != NULL);
 
-  g_dbus_proxy_call (item->item_proxy, "SecondaryActivate",
-                     g_variant_new ("(ii)", x_root, y_root),
-                     G_DBUS_CALL_FLAGS_NONE,
-                     -1, NULL, NULL, NULL);
+  sn_item_activate_call (item, SN_ITEM_LATENCY_SECONDARY_ACTIVATE, "SecondaryActivate",
+                         x_root, y_root, input_time);
+}
+
+
+
+void
+sn_item_get_latency (SnItem             *item,
+                     SnItemLatencyCall   call,
+                     SnItemLatencyStage  stage,
+                     guint              *buckets)
+{
+  g_return_if_fail (XFCE_IS_SN_ITEM (item));
+  g_return_if_fail (call < SN_ITEM_LATENCY_N_CALLS);
+  g_return_if_fail (stage < SN_ITEM_LATENCY_N_STAGES);
+  g_return_if_fail (buckets != NULL);
+
+  /* stays empty unless SN_DEBUG_LATENCY is set */
+  memcpy (buckets, item->latency[call][stage], sizeof (item->latency[call][stage]));
 }
 
 
@@ -25,6 +25,7 @@ G_BEGIN_DECLS
 
 typedef struct _SnItemClass SnItemClass;
 typedef struct _SnItem      SnItem;
+typedef struct _SnItemState SnItemState;
 
 #define XFCE_TYPE_SN_ITEM            (sn_item_get_type ())
 #define XFCE_SN_ITEM(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), XFCE_TYPE_SN_ITEM, SnItem))
@@ -33,36 +34,94 @@ typedef struct _SnItem      SnItem;
 #define XFCE_IS_SN_ITEM_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), XFCE_TYPE_SN_ITEM))
 #define XFCE_SN_ITEM_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), XFCE_TYPE_SN_ITEM, SnItemClass))
 
+/* fields of item state which differ from the previous state */
+typedef enum
+{
+  SN_ITEM_STATE_TOOLTIP    = 1 << 0,
+  SN_ITEM_STATE_THEME_PATH = 1 << 1,
+  SN_ITEM_STATE_ICON       = 1 << 2,
+  SN_ITEM_STATE_OVERLAY    = 1 << 3,
+  SN_ITEM_STATE_MENU       = 1 << 4
+}
+SnItemStateChanges;
+
+/* bucket 0 counts latencies below 2 us, bucket n counts [2^n, 2^(n+1)) us
+ * and the last bucket counts everything above */
+#define SN_ITEM_LATENCY_BUCKETS 24
+
+typedef enum
+{
+  SN_ITEM_LATENCY_ACTIVATE,
+  SN_ITEM_LATENCY_SECONDARY_ACTIVATE,
+  SN_ITEM_LATENCY_N_CALLS
+}
+SnItemLatencyCall;
+
+typedef enum
+{
+  SN_ITEM_LATENCY_DISPATCH,  /* input event -> call sent */
+  SN_ITEM_LATENCY_REPLY,     /* call sent -> reply received */
+  SN_ITEM_LATENCY_N_STAGES
+}
+SnItemLatencyStage;
+
+/* immutable snapshot of resolved item properties, shared by reference */
+struct _SnItemState
+{
+  gint                 ref_count;
+
+  gchar               *tooltip_title;
+  gchar               *tooltip_subtitle;
+
+  gchar               *icon_theme_path;
+  gchar               *icon_name;
+  cairo_surface_t     *icon_surface;
+  gchar               *overlay_icon_name;
+  cairo_surface_t     *overlay_icon_surface;
+
+  gboolean             item_is_menu;
+  gchar               *menu_object_path;
+};
+
+SnItemState           *sn_item_state_ref                       (SnItemState             *state);
+
+void                   sn_item_state_unref                     (SnItemState             *state);
+
 GType                  sn_item_get_type                        (void) G_GNUC_CONST;
 
 void                   sn_item_start                           (SnItem                  *item);
 
 void                   sn_item_invalidate                      (SnItem                  *item);
 
-const gchar           *sn_item_get_name                        (SnItem                  *item);
+void                   sn_item_update                          (SnItem                  *item);
 
-void                   sn_item_get_icon                        (SnItem                  *item,
-                                                                const gchar            **theme_path,
-                                                                const gchar            **icon_name,
-                                                                GdkPixbuf              **icon_pixbuf,
-                                                                const gchar            **overlay_icon_name,
-                                                                GdkPixbuf              **overlay_icon_pixbuf);
+const gchar           *sn_item_get_name                        (SnItem                  *item);
 
-void                   sn_item_get_tooltip                     (SnItem                  *item,
-	                                                           const gchar            **title,
-	                                                           const gchar            **subtitle);
+SnItemState           *sn_item_get_state                       (SnItem                  *item);
 
 gboolean               sn_item_is_menu_only                    (SnItem                  *item);
 
+gboolean               sn_item_has_evicted_menu                (SnItem                  *item);
+
 GtkWidget             *sn_item_get_menu                        (SnItem                  *item);
 
+void                   sn_item_set_menu_cache_size             (gconstpointer            owner,
+                                                                guint                    size);
+
 void                   sn_item_activate                        (SnItem                  *item,
                                                                 gint                     x_root,
-                                                                gint                     y_root);
+                                                                gint                     y_root,
+                                                                gint64                   input_time);
 
 void                   sn_item_secondary_activate              (SnItem                  *item,
                                                                 gint                     x_root,
-                                                                gint                     y_root);
+                                                                gint                     y_root,
+                                                                gint64                   input_time);
+
+void                   sn_item_get_latency                     (SnItem                  *item,
+                                                                SnItemLatencyCall        call,
+                                                                SnItemLatencyStage       stage,
+                                                                guint                   *buckets);
 
 void                   sn_item_scroll                          (SnItem                  *item,
                                                                 gint                     delta_x,
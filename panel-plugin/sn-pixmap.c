@@ -0,0 +1,412 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#if defined (__GNUC__) && defined (__x86_64__)
+#define SN_PIXMAP_AVX2
+#include <immintrin.h>
+#elif defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "sn-pixmap.h"
+
+
+
+/* fixed point weights of the downscaler, vertical ones must stay below 2^15
+ * for the SIMD paths, the products of both fit in FILTER_SHIFT bits */
+#define VERTICAL_ONE    (1 << 14)
+#define HORIZONTAL_ONE  (1 << 16)
+#define FILTER_SHIFT    30
+#define FILTER_ROUND    (G_GUINT64_CONSTANT (1) << (FILTER_SHIFT - 1))
+
+
+
+static inline guint
+sn_pixmap_multiply_alpha (guint x,
+                          guint a)
+{
+  guint t = x * a + 0x80;
+
+  /* (x * a) / 255 rounded, exact for all 8 bit values */
+  return (t + (t >> 8)) >> 8;
+}
+
+
+
+cairo_surface_t *
+sn_pixmap_surface_new (const guchar *data,
+                       gint          width,
+                       gint          height)
+{
+  cairo_surface_t *surface;
+  guchar          *pixels;
+  guint32         *row;
+  const guchar    *src;
+  gint             stride;
+  gint             x, y;
+  guint            a;
+
+  g_return_val_if_fail (data != NULL, NULL);
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  cairo_surface_flush (surface);
+  pixels = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  /* SNI pixmaps are ARGB32 in network byte order, cairo wants
+   * native endian premultiplied ARGB32, convert both in one pass */
+  src = data;
+  for (y = 0; y < height; y++)
+    {
+      row = (guint32 *) (pixels + y * stride);
+      for (x = 0; x < width; x++, src += 4)
+        {
+          a = src[0];
+          row[x] = (a << 24) |
+                   (sn_pixmap_multiply_alpha (src[1], a) << 16) |
+                   (sn_pixmap_multiply_alpha (src[2], a) << 8) |
+                   sn_pixmap_multiply_alpha (src[3], a);
+        }
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+
+gboolean
+sn_pixmap_surface_equal (cairo_surface_t *surface1,
+                         cairo_surface_t *surface2)
+{
+  gint width, height, stride;
+  gint y;
+
+  if (surface1 == surface2)
+    return TRUE;
+
+  if (surface1 == NULL || surface2 == NULL)
+    return FALSE;
+
+  width = cairo_image_surface_get_width (surface1);
+  height = cairo_image_surface_get_height (surface1);
+  stride = cairo_image_surface_get_stride (surface1);
+
+  if (width != cairo_image_surface_get_width (surface2) ||
+      height != cairo_image_surface_get_height (surface2) ||
+      stride != cairo_image_surface_get_stride (surface2))
+    return FALSE;
+
+  for (y = 0; y < height; y++)
+    {
+      if (memcmp (cairo_image_surface_get_data (surface1) + y * stride,
+                  cairo_image_surface_get_data (surface2) + y * stride,
+                  4 * width) != 0)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+
+
+typedef void (*AccumulateFunc) (guint32      *accum,
+                                const guint8 *row,
+                                gint          n,
+                                guint32       weight);
+
+typedef struct
+{
+  gint                *first;
+  gint                *count;
+  gint                *weights;
+  gint                 taps;
+}
+Filter;
+
+
+
+static void
+sn_pixmap_filter_init (Filter *filter,
+                       gint    src,
+                       gint    dst,
+                       gint    one)
+{
+  gint *weights;
+  gint  start, end;
+  gint  overlap, sum, largest;
+  gint  i, j, n;
+
+  /* at most this many source pixels touch one destination pixel */
+  filter->taps = (src + dst - 1) / dst + 1;
+  filter->first = g_new (gint, dst);
+  filter->count = g_new (gint, dst);
+  filter->weights = g_new0 (gint, dst * filter->taps);
+
+  for (i = 0; i < dst; i++)
+    {
+      weights = filter->weights + i * filter->taps;
+
+      /* coordinates are in 1/dst of a source pixel, so the areas are exact */
+      start = i * src;
+      end = start + src;
+      filter->first[i] = start / dst;
+
+      sum = 0;
+      largest = 0;
+      for (n = 0, j = filter->first[i]; j * dst < end && n < filter->taps; n++, j++)
+        {
+          overlap = MIN (end, (j + 1) * dst) - MAX (start, j * dst);
+          weights[n] = (gint) ((gint64) overlap * one / src);
+          sum += weights[n];
+          if (weights[n] > weights[largest])
+            largest = n;
+        }
+
+      /* weights must add up exactly, or flat areas change their color */
+      weights[largest] += one - sum;
+      filter->count[i] = n;
+    }
+}
+
+
+
+static void
+sn_pixmap_filter_clear (Filter *filter)
+{
+  g_free (filter->first);
+  g_free (filter->count);
+  g_free (filter->weights);
+}
+
+
+
+static void
+sn_pixmap_accumulate_c (guint32      *accum,
+                        const guint8 *row,
+                        gint          n,
+                        guint32       weight)
+{
+  gint i;
+
+  for (i = 0; i < n; i++)
+    accum[i] += row[i] * weight;
+}
+
+
+
+#ifdef __SSE2__
+static void
+sn_pixmap_accumulate_sse2 (guint32      *accum,
+                           const guint8 *row,
+                           gint          n,
+                           guint32       weight)
+{
+  __m128i  zero = _mm_setzero_si128 ();
+  __m128i  w = _mm_set1_epi32 ((gint) weight);
+  __m128i  p, lo, hi;
+  __m128i *a;
+  gint     i;
+
+  /* every 32 bit lane holds (value, 0) as 16 bit pairs, so madd
+   * is a plain multiply, weights are below 2^15 */
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      p = _mm_loadu_si128 ((const __m128i *) (row + i));
+      lo = _mm_unpacklo_epi8 (p, zero);
+      hi = _mm_unpackhi_epi8 (p, zero);
+      a = (__m128i *) (accum + i);
+
+      _mm_storeu_si128 (a + 0, _mm_add_epi32 (_mm_loadu_si128 (a + 0),
+                                              _mm_madd_epi16 (_mm_unpacklo_epi16 (lo, zero), w)));
+      _mm_storeu_si128 (a + 1, _mm_add_epi32 (_mm_loadu_si128 (a + 1),
+                                              _mm_madd_epi16 (_mm_unpackhi_epi16 (lo, zero), w)));
+      _mm_storeu_si128 (a + 2, _mm_add_epi32 (_mm_loadu_si128 (a + 2),
+                                              _mm_madd_epi16 (_mm_unpacklo_epi16 (hi, zero), w)));
+      _mm_storeu_si128 (a + 3, _mm_add_epi32 (_mm_loadu_si128 (a + 3),
+                                              _mm_madd_epi16 (_mm_unpackhi_epi16 (hi, zero), w)));
+    }
+
+  sn_pixmap_accumulate_c (accum + i, row + i, n - i, weight);
+}
+#endif
+
+
+
+#ifdef SN_PIXMAP_AVX2
+__attribute__ ((target ("avx2")))
+static void
+sn_pixmap_accumulate_avx2 (guint32      *accum,
+                           const guint8 *row,
+                           gint          n,
+                           guint32       weight)
+{
+  __m256i  w = _mm256_set1_epi32 ((gint) weight);
+  __m256i  p;
+  __m256i *a;
+  gint     i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      p = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) (row + i)));
+      a = (__m256i *) (accum + i);
+
+      _mm256_storeu_si256 (a, _mm256_add_epi32 (_mm256_loadu_si256 (a),
+                                                _mm256_madd_epi16 (p, w)));
+    }
+
+  sn_pixmap_accumulate_c (accum + i, row + i, n - i, weight);
+}
+#endif
+
+
+
+static AccumulateFunc
+sn_pixmap_get_accumulate (void)
+{
+#ifdef SN_PIXMAP_AVX2
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return sn_pixmap_accumulate_avx2;
+#endif
+#ifdef __SSE2__
+  return sn_pixmap_accumulate_sse2;
+#else
+  return sn_pixmap_accumulate_c;
+#endif
+}
+
+
+
+/* the accumulator is passed in, so tests can compare all of them */
+static cairo_surface_t *
+sn_pixmap_surface_scale_with (cairo_surface_t *surface,
+                              gint             width,
+                              gint             height,
+                              AccumulateFunc   accumulate)
+{
+  cairo_surface_t *scaled;
+  cairo_t         *cr;
+  Filter           filter_x, filter_y;
+  const guint8    *src;
+  guint8          *dst;
+  guint32         *accum;
+  guint64          sum[4];
+  gint             src_width, src_height, src_stride, dst_stride;
+  gint             x, y, k, c;
+  const gint      *weights;
+  const guint32   *column;
+
+  src_width = cairo_image_surface_get_width (surface);
+  src_height = cairo_image_surface_get_height (surface);
+
+  scaled = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+
+  if (width > src_width || height > src_height)
+    {
+      /* the box filter only reduces, cairo handles the rest */
+      cr = cairo_create (scaled);
+      cairo_scale (cr, (gdouble) width / src_width, (gdouble) height / src_height);
+      cairo_set_source_surface (cr, surface, 0, 0);
+      cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_GOOD);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+
+      return scaled;
+    }
+
+  cairo_surface_flush (surface);
+  cairo_surface_flush (scaled);
+  src = cairo_image_surface_get_data (surface);
+  src_stride = cairo_image_surface_get_stride (surface);
+  dst = cairo_image_surface_get_data (scaled);
+  dst_stride = cairo_image_surface_get_stride (scaled);
+
+  /* area averaging of premultiplied pixels: every output pixel is the
+   * coverage weighted mean of the source pixels below it, rows are
+   * reduced first, all 4 channels are handled the same way */
+  sn_pixmap_filter_init (&filter_y, src_height, height, VERTICAL_ONE);
+  sn_pixmap_filter_init (&filter_x, src_width, width, HORIZONTAL_ONE);
+
+  accum = g_new (guint32, 4 * src_width);
+
+  for (y = 0; y < height; y++)
+    {
+      memset (accum, 0, 4 * src_width * sizeof (guint32));
+
+      weights = filter_y.weights + y * filter_y.taps;
+      for (k = 0; k < filter_y.count[y]; k++)
+        {
+          accumulate (accum, src + (gsize) (filter_y.first[y] + k) * src_stride,
+                      4 * src_width, weights[k]);
+        }
+
+      for (x = 0; x < width; x++)
+        {
+          sum[0] = sum[1] = sum[2] = sum[3] = 0;
+
+          weights = filter_x.weights + x * filter_x.taps;
+          column = accum + 4 * filter_x.first[x];
+          for (k = 0; k < filter_x.count[x]; k++, column += 4)
+            for (c = 0; c < 4; c++)
+              sum[c] += (guint64) column[c] * weights[k];
+
+          for (c = 0; c < 4; c++)
+            dst[y * dst_stride + 4 * x + c] = (sum[c] + FILTER_ROUND) >> FILTER_SHIFT;
+        }
+    }
+
+  g_free (accum);
+  sn_pixmap_filter_clear (&filter_x);
+  sn_pixmap_filter_clear (&filter_y);
+
+  cairo_surface_mark_dirty (scaled);
+
+  return scaled;
+}
+
+
+
+cairo_surface_t *
+sn_pixmap_surface_scale (cairo_surface_t *surface,
+                         gint             width,
+                         gint             height)
+{
+  g_return_val_if_fail (surface != NULL, NULL);
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  return sn_pixmap_surface_scale_with (surface, width, height, sn_pixmap_get_accumulate ());
+}
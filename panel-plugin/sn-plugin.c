@@ -31,6 +31,7 @@
 #include "sn-box.h"
 #include "sn-button.h"
 #include "sn-dialog.h"
+#include "sn-icon-cache.h"
 #include "sn-item.h"
 #include "sn-plugin.h"
 
@@ -108,6 +109,11 @@ sn_plugin_free (XfcePanelPlugin *panel_plugin)
   /* remove children so they won't use unrefed SnItems and SnConfig */
   gtk_container_remove (GTK_CONTAINER (panel_plugin), plugin->box);
 
+  /* other plugins of the process keep their menu cache limits */
+  sn_item_set_menu_cache_size (plugin, 0);
+
+  sn_icon_cache_dump_stats ();
+
   g_object_unref (plugin->backend);
   g_object_unref (plugin->config);
 }
@@ -201,6 +207,14 @@ sn_plugin_show_about (XfcePanelPlugin *panel_plugin)
 
 
 
+static void
+sn_plugin_menu_cache_size_changed (SnPlugin *plugin)
+{
+  sn_item_set_menu_cache_size (plugin, sn_config_get_menu_cache_size (plugin->config));
+}
+
+
+
 static void
 sn_plugin_item_added (SnPlugin *plugin,
                       SnItem   *item)
@@ -247,6 +261,10 @@ sn_plugin_construct (XfcePanelPlugin *panel_plugin)
   g_signal_connect_swapped (plugin->config, "configuration-changed",
                             G_CALLBACK (gtk_widget_queue_resize), plugin->box);
 
+  g_signal_connect_swapped (plugin->config, "notify::menu-cache-size",
+                            G_CALLBACK (sn_plugin_menu_cache_size_changed), plugin);
+  sn_plugin_menu_cache_size_changed (plugin);
+
   plugin->backend = sn_backend_new ();
   g_signal_connect_swapped (plugin->backend, "item-added",
                             G_CALLBACK (sn_plugin_item_added), plugin);
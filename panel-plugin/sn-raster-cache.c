@@ -0,0 +1,363 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "sn-raster-cache.h"
+
+
+
+#define RASTER_CACHE_MAGIC    0x43524e53 /* "SNRC" */
+#define RASTER_CACHE_VERSION  1
+
+/* rasters kept on disk, trimmed every RASTER_CACHE_TRIM_INTERVAL stores */
+#define RASTER_CACHE_SIZE           512
+#define RASTER_CACHE_TRIM_INTERVAL  32
+
+/* use times are only recorded with this precision, in seconds */
+#define RASTER_CACHE_TOUCH_INTERVAL (60 * 60)
+
+/* larger rasters are not cached, the bound keeps the size arithmetic in range */
+#define RASTER_CACHE_MAX_PIXELS     4096
+#define RASTER_CACHE_MAX_ROWSTRIDE  (RASTER_CACHE_MAX_PIXELS * 4 + 3)
+
+
+
+/* every entry is a separate file: header, key, then the pixels as they are
+ * laid out in the pixbuf, so the pixbuf can be created on top of the mapping */
+typedef struct
+{
+  guint32              magic;
+  guint32              version;
+  guint32              key_length;
+  guint32              width;
+  guint32              height;
+  guint32              rowstride;
+  guint32              has_alpha;
+  guint32              checksum;
+}
+RasterHeader;
+
+typedef struct
+{
+  gchar               *filename;
+  gint64               mtime;
+}
+RasterFile;
+
+
+
+/* lookups and stores also happen in icon loading threads */
+G_LOCK_DEFINE_STATIC (sn_raster_cache);
+static guint    sn_raster_cache_stores = 0;
+static gboolean sn_raster_cache_trimming = FALSE;
+
+
+
+static const gchar *
+sn_raster_cache_get_dir (void)
+{
+  static gchar *dir = NULL;
+  gchar        *path;
+
+  if (g_once_init_enter (&dir))
+    {
+      path = g_build_filename (g_get_user_cache_dir (),
+                               "xfce4", "statusnotifier-plugin", "icons", NULL);
+      g_mkdir_with_parents (path, 0700);
+      g_once_init_leave (&dir, path);
+    }
+
+  return dir;
+}
+
+
+
+static gchar *
+sn_raster_cache_get_filename (const gchar *key)
+{
+  gchar *name;
+  gchar *filename;
+
+  name = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  filename = g_build_filename (sn_raster_cache_get_dir (), name, NULL);
+  g_free (name);
+
+  return filename;
+}
+
+
+
+static guint32
+sn_raster_cache_checksum (const guint8 *data,
+                          gsize         length)
+{
+  guint32 hash = 2166136261u;
+  gsize   i;
+
+  /* FNV-1a, it only has to detect truncated or damaged files */
+  for (i = 0; i < length; i++)
+    hash = (hash ^ data[i]) * 16777619u;
+
+  return hash;
+}
+
+
+
+GdkPixbuf *
+sn_raster_cache_lookup (const gchar *key)
+{
+  GMappedFile        *mapped;
+  const RasterHeader *header;
+  const gchar        *contents;
+  gchar              *filename;
+  gsize               length;
+  gsize               key_length;
+  gsize               channels;
+  gsize               data_offset;
+  gsize               data_length;
+  GBytes             *bytes;
+  GBytes             *data;
+  GdkPixbuf          *pixbuf = NULL;
+  GStatBuf            st;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  filename = sn_raster_cache_get_filename (key);
+
+  mapped = g_mapped_file_new (filename, FALSE, NULL);
+  if (mapped == NULL)
+    {
+      g_free (filename);
+      return NULL;
+    }
+
+  contents = g_mapped_file_get_contents (mapped);
+  length = g_mapped_file_get_length (mapped);
+  header = (const RasterHeader *) contents;
+  key_length = strlen (key);
+
+  /* the file is untrusted, dimensions are bounded before any arithmetic */
+  if (length < sizeof (RasterHeader) ||
+      header->magic != RASTER_CACHE_MAGIC ||
+      header->version != RASTER_CACHE_VERSION ||
+      header->key_length != key_length ||
+      header->width == 0 || header->width > RASTER_CACHE_MAX_PIXELS ||
+      header->height == 0 || header->height > RASTER_CACHE_MAX_PIXELS ||
+      header->rowstride > RASTER_CACHE_MAX_ROWSTRIDE)
+    goto invalid;
+
+  channels = header->has_alpha ? 4 : 3;
+  if ((gsize) header->rowstride < (gsize) header->width * channels)
+    goto invalid;
+
+  data_offset = sizeof (RasterHeader) + ((key_length + 3) & ~3);
+  data_length = (gsize) header->rowstride * (header->height - 1) +
+                (gsize) header->width * channels;
+
+  /* the name is a hash of the key, so the key itself is compared as well */
+  if (length != data_offset + data_length ||
+      memcmp (contents + sizeof (RasterHeader), key, key_length) != 0 ||
+      sn_raster_cache_checksum ((const guint8 *) contents + data_offset, data_length) != header->checksum)
+    goto invalid;
+
+  /* the mapping stays valid even when the file gets replaced or evicted */
+  bytes = g_mapped_file_get_bytes (mapped);
+  data = g_bytes_new_from_bytes (bytes, data_offset, data_length);
+  pixbuf = gdk_pixbuf_new_from_bytes (data, GDK_COLORSPACE_RGB, header->has_alpha != 0, 8,
+                                      header->width, header->height, header->rowstride);
+  g_bytes_unref (data);
+  g_bytes_unref (bytes);
+
+  /* recently used entries are the last to be evicted,
+   * the mtime is not rewritten on every hit */
+  if (g_stat (filename, &st) == 0 &&
+      (gint64) st.st_mtime + RASTER_CACHE_TOUCH_INTERVAL < g_get_real_time () / G_USEC_PER_SEC)
+    g_utime (filename, NULL);
+
+  g_mapped_file_unref (mapped);
+  g_free (filename);
+
+  return pixbuf;
+
+invalid:
+  g_debug ("Removing invalid raster cache entry %s", filename);
+  g_unlink (filename);
+  g_mapped_file_unref (mapped);
+  g_free (filename);
+
+  return NULL;
+}
+
+
+
+static gint
+sn_raster_cache_file_compare (gconstpointer a,
+                              gconstpointer b)
+{
+  const RasterFile *file_a = *(RasterFile * const *) a;
+  const RasterFile *file_b = *(RasterFile * const *) b;
+
+  return (file_a->mtime > file_b->mtime) - (file_a->mtime < file_b->mtime);
+}
+
+
+
+static void
+sn_raster_cache_file_free (gpointer data)
+{
+  RasterFile *file = data;
+
+  g_free (file->filename);
+  g_free (file);
+}
+
+
+
+static void
+sn_raster_cache_trim_thread (GTask        *task,
+                             gpointer      source_object,
+                             gpointer      task_data,
+                             GCancellable *cancellable)
+{
+  GDir        *dir;
+  const gchar *name;
+  GPtrArray   *files;
+  RasterFile  *file;
+  GStatBuf     st;
+  guint        i;
+
+  dir = g_dir_open (sn_raster_cache_get_dir (), 0, NULL);
+  if (dir == NULL)
+    {
+      G_LOCK (sn_raster_cache);
+      sn_raster_cache_trimming = FALSE;
+      G_UNLOCK (sn_raster_cache);
+      g_task_return_boolean (task, FALSE);
+      return;
+    }
+
+  files = g_ptr_array_new_with_free_func (sn_raster_cache_file_free);
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      file = g_new0 (RasterFile, 1);
+      file->filename = g_build_filename (sn_raster_cache_get_dir (), name, NULL);
+      file->mtime = g_stat (file->filename, &st) == 0 ? (gint64) st.st_mtime : 0;
+      g_ptr_array_add (files, file);
+    }
+
+  g_dir_close (dir);
+
+  if (files->len > RASTER_CACHE_SIZE)
+    {
+      /* least recently used entries first */
+      g_ptr_array_sort (files, sn_raster_cache_file_compare);
+
+      for (i = 0; i < files->len - RASTER_CACHE_SIZE; i++)
+        g_unlink (((RasterFile *) g_ptr_array_index (files, i))->filename);
+
+      g_debug ("Evicted %u raster cache entries", files->len - RASTER_CACHE_SIZE);
+    }
+
+  g_ptr_array_free (files, TRUE);
+
+  G_LOCK (sn_raster_cache);
+  sn_raster_cache_trimming = FALSE;
+  G_UNLOCK (sn_raster_cache);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+
+
+void
+sn_raster_cache_store (const gchar *key,
+                       GdkPixbuf   *pixbuf)
+{
+  RasterHeader  header;
+  GByteArray   *array;
+  const guint8 *pixels;
+  gsize         key_length;
+  gsize         data_length;
+  gchar        *filename;
+  guint8        padding[4] = { 0, };
+  gboolean      trim;
+  GTask        *task;
+
+  g_return_if_fail (key != NULL);
+  g_return_if_fail (GDK_IS_PIXBUF (pixbuf));
+
+  /* only plain 8 bit RGB(A) data within the bounds can be mapped back */
+  if (gdk_pixbuf_get_colorspace (pixbuf) != GDK_COLORSPACE_RGB ||
+      gdk_pixbuf_get_bits_per_sample (pixbuf) != 8 ||
+      gdk_pixbuf_get_width (pixbuf) > RASTER_CACHE_MAX_PIXELS ||
+      gdk_pixbuf_get_height (pixbuf) > RASTER_CACHE_MAX_PIXELS ||
+      gdk_pixbuf_get_rowstride (pixbuf) > RASTER_CACHE_MAX_ROWSTRIDE)
+    return;
+
+  key_length = strlen (key);
+  pixels = gdk_pixbuf_read_pixels (pixbuf);
+  data_length = gdk_pixbuf_get_byte_length (pixbuf);
+
+  header.magic = RASTER_CACHE_MAGIC;
+  header.version = RASTER_CACHE_VERSION;
+  header.key_length = key_length;
+  header.width = gdk_pixbuf_get_width (pixbuf);
+  header.height = gdk_pixbuf_get_height (pixbuf);
+  header.rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  header.has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+  header.checksum = sn_raster_cache_checksum (pixels, data_length);
+
+  array = g_byte_array_sized_new (sizeof (header) + key_length + 4 + data_length);
+  g_byte_array_append (array, (const guint8 *) &header, sizeof (header));
+  g_byte_array_append (array, (const guint8 *) key, key_length);
+  g_byte_array_append (array, padding, ((key_length + 3) & ~3) - key_length);
+  g_byte_array_append (array, pixels, data_length);
+
+  /* written to a temporary file and renamed, readers never see partial entries */
+  filename = sn_raster_cache_get_filename (key);
+  g_file_set_contents (filename, (const gchar *) array->data, array->len, NULL);
+  g_free (filename);
+  g_byte_array_free (array, TRUE);
+
+  /* the first trim comes after some stores, not with the first one */
+  G_LOCK (sn_raster_cache);
+  trim = (++sn_raster_cache_stores % RASTER_CACHE_TRIM_INTERVAL) == 0 && !sn_raster_cache_trimming;
+  if (trim)
+    sn_raster_cache_trimming = TRUE;
+  G_UNLOCK (sn_raster_cache);
+
+  if (trim)
+    {
+      /* stores happen on the main thread too, the directory is read in a worker */
+      task = g_task_new (NULL, NULL, NULL, NULL);
+      g_task_run_in_thread (task, sn_raster_cache_trim_thread);
+      g_object_unref (task);
+    }
+}
@@ -163,3 +163,186 @@ sn_container_has_children (GtkWidget *widget)
 
   return has_children;
 }
+
+
+
+void
+sn_scroll_queue_init (SnScrollQueue *queue)
+{
+  queue->delta_x = 0;
+  queue->delta_y = 0;
+  queue->flush_time = G_MININT64;
+}
+
+
+
+void
+sn_scroll_queue_add (SnScrollQueue *queue,
+                     gdouble        delta_x,
+                     gdouble        delta_y)
+{
+  /* every event moves at least one step in its direction */
+  delta_x = (delta_x == 0 ? 0 : delta_x > 0 ? 1 : -1) *
+            MAX (ABS (delta_x) + 0.5, 1);
+  delta_y = (delta_y == 0 ? 0 : delta_y > 0 ? 1 : -1) *
+            MAX (ABS (delta_y) + 0.5, 1);
+
+  queue->delta_x += (gint) delta_x;
+  queue->delta_y += (gint) delta_y;
+}
+
+
+
+gboolean
+sn_scroll_queue_is_empty (SnScrollQueue *queue)
+{
+  return queue->delta_x == 0 && queue->delta_y == 0;
+}
+
+
+
+gboolean
+sn_scroll_queue_flush (SnScrollQueue *queue,
+                       gint64         now,
+                       guint          rate,
+                       gint          *delta_x,
+                       gint          *delta_y)
+{
+  if (sn_scroll_queue_is_empty (queue))
+    return FALSE;
+
+  /* rate is in calls per second, 0 flushes on every call */
+  if (rate > 0 && queue->flush_time != G_MININT64 &&
+      now - queue->flush_time < G_USEC_PER_SEC / rate)
+    return FALSE;
+
+  *delta_x = queue->delta_x;
+  *delta_y = queue->delta_y;
+
+  queue->delta_x = 0;
+  queue->delta_y = 0;
+  queue->flush_time = now;
+
+  return TRUE;
+}
+
+
+
+typedef struct
+{
+  gpointer             data;
+  gint64               deadline;
+}
+SnDeadline;
+
+
+
+void
+sn_deadline_queue_init (SnDeadlineQueue *queue)
+{
+  g_queue_init (&queue->queue);
+  queue->links = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+
+
+void
+sn_deadline_queue_clear (SnDeadlineQueue *queue)
+{
+  g_queue_foreach (&queue->queue, (GFunc) g_free, NULL);
+  g_queue_clear (&queue->queue);
+  g_hash_table_destroy (queue->links);
+  queue->links = NULL;
+}
+
+
+
+void
+sn_deadline_queue_set (SnDeadlineQueue *queue,
+                       gpointer         data,
+                       gint64           deadline)
+{
+  SnDeadline *entry;
+  GList      *link, *sibling;
+
+  link = g_hash_table_lookup (queue->links, data);
+  if (link != NULL)
+    {
+      entry = link->data;
+      g_queue_delete_link (&queue->queue, link);
+    }
+  else
+    {
+      entry = g_new (SnDeadline, 1);
+      entry->data = data;
+    }
+
+  entry->deadline = deadline;
+
+  /* deadlines mostly grow, so the place is found near the tail */
+  for (sibling = queue->queue.tail; sibling != NULL; sibling = sibling->prev)
+    if (((SnDeadline *) sibling->data)->deadline <= deadline)
+      break;
+
+  if (sibling != NULL)
+    {
+      g_queue_insert_after (&queue->queue, sibling, entry);
+      link = sibling->next;
+    }
+  else
+    {
+      g_queue_push_head (&queue->queue, entry);
+      link = queue->queue.head;
+    }
+
+  g_hash_table_insert (queue->links, data, link);
+}
+
+
+
+void
+sn_deadline_queue_remove (SnDeadlineQueue *queue,
+                          gpointer         data)
+{
+  GList *link;
+
+  link = g_hash_table_lookup (queue->links, data);
+  if (link == NULL)
+    return;
+
+  g_hash_table_remove (queue->links, data);
+  g_free (link->data);
+  g_queue_delete_link (&queue->queue, link);
+}
+
+
+
+gint64
+sn_deadline_queue_next (SnDeadlineQueue *queue)
+{
+  SnDeadline *entry;
+
+  entry = g_queue_peek_head (&queue->queue);
+
+  return entry != NULL ? entry->deadline : G_MAXINT64;
+}
+
+
+
+gpointer
+sn_deadline_queue_pop (SnDeadlineQueue *queue,
+                       gint64           until)
+{
+  SnDeadline *entry;
+  gpointer    data;
+
+  /* only the due head is looked at, the rest is due later */
+  entry = g_queue_peek_head (&queue->queue);
+  if (entry == NULL || entry->deadline > until)
+    return NULL;
+
+  data = entry->data;
+  sn_deadline_queue_remove (queue, data);
+
+  return data;
+}
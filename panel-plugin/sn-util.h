@@ -23,6 +23,23 @@
 
 G_BEGIN_DECLS
 
+/* scroll steps accumulated between Scroll calls */
+typedef struct
+{
+  gint                 delta_x;
+  gint                 delta_y;
+  gint64               flush_time;
+}
+SnScrollQueue;
+
+/* pending deadlines, sorted with the earliest first */
+typedef struct
+{
+  GQueue               queue;
+  GHashTable          *links;
+}
+SnDeadlineQueue;
+
 gulong                 sn_signal_connect_weak                  (gpointer                 instance,
                                                                 const gchar             *detailed_signal,
                                                                 GCallback                c_handler,
@@ -35,6 +52,36 @@ gulong                 sn_signal_connect_weak_swapped          (gpointer
 
 gboolean               sn_container_has_children               (GtkWidget               *widget);
 
+void                   sn_scroll_queue_init                    (SnScrollQueue           *queue);
+
+void                   sn_scroll_queue_add                     (SnScrollQueue           *queue,
+                                                                gdouble                  delta_x,
+                                                                gdouble                  delta_y);
+
+gboolean               sn_scroll_queue_is_empty                (SnScrollQueue           *queue);
+
+gboolean               sn_scroll_queue_flush                   (SnScrollQueue           *queue,
+                                                                gint64                   now,
+                                                                guint                    rate,
+                                                                gint                    *delta_x,
+                                                                gint                    *delta_y);
+
+void                   sn_deadline_queue_init                  (SnDeadlineQueue         *queue);
+
+void                   sn_deadline_queue_clear                 (SnDeadlineQueue         *queue);
+
+void                   sn_deadline_queue_set                   (SnDeadlineQueue         *queue,
+                                                                gpointer                 data,
+                                                                gint64                   deadline);
+
+void                   sn_deadline_queue_remove                (SnDeadlineQueue         *queue,
+                                                                gpointer                 data);
+
+gint64                 sn_deadline_queue_next                  (SnDeadlineQueue         *queue);
+
+gpointer               sn_deadline_queue_pop                   (SnDeadlineQueue         *queue,
+                                                                gint64                   until);
+
 G_END_DECLS
 
 #endif /* !__SN_UTIL_H__ */
@@ -0,0 +1,352 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+/* the accumulators are static, the tests are built with the downscaler */
+#include "sn-pixmap.c"
+
+
+
+typedef struct
+{
+  const gchar         *name;
+  AccumulateFunc       accumulate;
+}
+Path;
+
+/* all accumulators the CPU can run, the scalar one comes first */
+static Path  paths[3];
+static guint n_paths = 0;
+
+/* odd sizes, so the SIMD paths also run their scalar tails */
+static const gint sizes[][4] =
+{
+  { 257, 131, 22, 17 },
+  { 97, 61, 23, 11 },
+  { 33, 33, 32, 32 },
+  { 255, 3, 7, 1 },
+  { 300, 200, 24, 24 },
+  { 5, 7, 5, 7 },
+  { 1, 1, 1, 1 }
+};
+
+
+
+static void
+test_add_path (const gchar    *name,
+               AccumulateFunc  accumulate)
+{
+  paths[n_paths].name = name;
+  paths[n_paths].accumulate = accumulate;
+  n_paths++;
+}
+
+
+
+static cairo_surface_t *
+test_surface_new (gint     width,
+                  gint     height,
+                  GRand   *rand,
+                  guint32  color)
+{
+  cairo_surface_t *surface;
+  guint32         *row;
+  guint            a;
+  gint             x, y;
+
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_surface_flush (surface);
+
+  for (y = 0; y < height; y++)
+    {
+      row = (guint32 *) (cairo_image_surface_get_data (surface) +
+                         y * cairo_image_surface_get_stride (surface));
+      for (x = 0; x < width; x++)
+        {
+          if (rand == NULL)
+            {
+              row[x] = color;
+              continue;
+            }
+
+          /* premultiplied, no channel exceeds the alpha */
+          a = g_rand_int_range (rand, 0, 256);
+          row[x] = (a << 24) |
+                   (g_rand_int_range (rand, 0, a + 1) << 16) |
+                   (g_rand_int_range (rand, 0, a + 1) << 8) |
+                   g_rand_int_range (rand, 0, a + 1);
+        }
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  return surface;
+}
+
+
+
+static gdouble
+test_overlap (gint i,
+              gint j,
+              gint src,
+              gint dst)
+{
+  /* the same exact coverage as the filter, in source pixels */
+  return (gdouble) (MIN ((i + 1) * src, (j + 1) * dst) - MAX (i * src, j * dst)) / dst;
+}
+
+
+
+static gint
+test_max_error (cairo_surface_t *source,
+                cairo_surface_t *scaled)
+{
+  const guint8 *src, *dst;
+  gint          src_width, src_height, src_stride;
+  gint          width, height, stride;
+  gint          x, y, i, j, c;
+  gdouble       weight, value;
+  gint          error = 0;
+
+  src = cairo_image_surface_get_data (source);
+  src_width = cairo_image_surface_get_width (source);
+  src_height = cairo_image_surface_get_height (source);
+  src_stride = cairo_image_surface_get_stride (source);
+  dst = cairo_image_surface_get_data (scaled);
+  width = cairo_image_surface_get_width (scaled);
+  height = cairo_image_surface_get_height (scaled);
+  stride = cairo_image_surface_get_stride (scaled);
+
+  /* area average in floating point */
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      for (c = 0; c < 4; c++)
+        {
+          value = 0;
+          for (j = y * src_height / height; j < src_height && j * height < (y + 1) * src_height; j++)
+            for (i = x * src_width / width; i < src_width && i * width < (x + 1) * src_width; i++)
+              {
+                weight = test_overlap (y, j, src_height, height) * test_overlap (x, i, src_width, width);
+                value += weight * src[j * src_stride + 4 * i + c];
+              }
+
+          value = value * width * height / ((gdouble) src_width * src_height);
+          error = MAX (error, ABS (dst[y * stride + 4 * x + c] - (gint) (value + 0.5)));
+        }
+
+  return error;
+}
+
+
+
+static void
+test_accumulate (void)
+{
+  GRand   *rand;
+  guint8  *row;
+  guint32 *expected, *accum;
+  gint     n, p, k, i;
+  guint32  weight;
+
+  rand = g_rand_new_with_seed (1);
+  row = g_new (guint8, 1031);
+  expected = g_new (guint32, 1031);
+  accum = g_new (guint32, 1031);
+
+  for (n = 1; n <= 1031; n += 17)
+    for (p = 1; p < (gint) n_paths; p++)
+      {
+        memset (expected, 0, n * sizeof (guint32));
+        memset (accum, 0, n * sizeof (guint32));
+
+        /* several rows add up like they do for one output row */
+        for (k = 0; k < 5; k++)
+          {
+            for (i = 0; i < n; i++)
+              row[i] = g_rand_int_range (rand, 0, 256);
+            weight = k == 0 ? VERTICAL_ONE : g_rand_int_range (rand, 0, VERTICAL_ONE);
+
+            sn_pixmap_accumulate_c (expected, row, n, weight);
+            paths[p].accumulate (accum, row, n, weight);
+          }
+
+        if (memcmp (expected, accum, n * sizeof (guint32)) != 0)
+          g_error ("%s accumulator differs from the scalar one for %d values", paths[p].name, n);
+      }
+
+  g_free (accum);
+  g_free (expected);
+  g_free (row);
+  g_rand_free (rand);
+}
+
+
+
+static void
+test_scale (void)
+{
+  GRand           *rand;
+  cairo_surface_t *source;
+  cairo_surface_t *expected, *scaled;
+  guint            s, p;
+
+  rand = g_rand_new_with_seed (2);
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      source = test_surface_new (sizes[s][0], sizes[s][1], rand, 0);
+      expected = sn_pixmap_surface_scale_with (source, sizes[s][2], sizes[s][3], paths[0].accumulate);
+
+      /* rounding of the fixed point weights stays within one step */
+      g_assert_cmpint (test_max_error (source, expected), <=, 1);
+
+      for (p = 1; p < n_paths; p++)
+        {
+          scaled = sn_pixmap_surface_scale_with (source, sizes[s][2], sizes[s][3], paths[p].accumulate);
+          if (!sn_pixmap_surface_equal (expected, scaled))
+            g_error ("%s path differs from the scalar one for %dx%d -> %dx%d", paths[p].name,
+                     sizes[s][0], sizes[s][1], sizes[s][2], sizes[s][3]);
+          cairo_surface_destroy (scaled);
+        }
+
+      cairo_surface_destroy (expected);
+      cairo_surface_destroy (source);
+    }
+
+  g_rand_free (rand);
+}
+
+
+
+static void
+test_scale_flat (void)
+{
+  cairo_surface_t *source;
+  cairo_surface_t *scaled;
+  cairo_surface_t *expected;
+  guint            s;
+
+  /* weights add up exactly, flat areas keep their color */
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      source = test_surface_new (sizes[s][0], sizes[s][1], NULL, 0x80402010);
+      expected = test_surface_new (sizes[s][2], sizes[s][3], NULL, 0x80402010);
+      scaled = sn_pixmap_surface_scale (source, sizes[s][2], sizes[s][3]);
+
+      g_assert_true (sn_pixmap_surface_equal (expected, scaled));
+
+      cairo_surface_destroy (scaled);
+      cairo_surface_destroy (expected);
+      cairo_surface_destroy (source);
+    }
+}
+
+
+
+static cairo_surface_t *
+test_scale_cairo (cairo_surface_t *surface,
+                  gint             width,
+                  gint             height)
+{
+  cairo_surface_t *scaled;
+  cairo_t         *cr;
+
+  /* what the icon box did before the box filter */
+  scaled = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cr = cairo_create (scaled);
+  cairo_scale (cr, (gdouble) width / cairo_image_surface_get_width (surface),
+               (gdouble) height / cairo_image_surface_get_height (surface));
+  cairo_set_source_surface (cr, surface, 0, 0);
+  cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_BILINEAR);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  cairo_surface_flush (scaled);
+
+  return scaled;
+}
+
+
+
+static void
+test_benchmark (void)
+{
+  GRand           *rand;
+  cairo_surface_t *source;
+  cairo_surface_t *scaled;
+  gdouble          elapsed;
+  guint            p, n;
+
+  rand = g_rand_new_with_seed (3);
+  source = test_surface_new (256, 256, rand, 0);
+
+  /* 256 -> 22 is the common reduction of application pixmaps */
+  for (p = 0; p <= n_paths; p++)
+    {
+      g_test_timer_start ();
+      for (n = 0; n < 1000; n++)
+        {
+          if (p < n_paths)
+            scaled = sn_pixmap_surface_scale_with (source, 22, 22, paths[p].accumulate);
+          else
+            scaled = test_scale_cairo (source, 22, 22);
+
+          if (n < 999)
+            cairo_surface_destroy (scaled);
+        }
+      elapsed = g_test_timer_elapsed ();
+
+      g_test_message ("%-8s %7.1f us per 256x256 -> 22x22, max error %d",
+                      p < n_paths ? paths[p].name : "bilinear",
+                      elapsed * 1000, test_max_error (source, scaled));
+      cairo_surface_destroy (scaled);
+    }
+
+  cairo_surface_destroy (source);
+  g_rand_free (rand);
+}
+
+
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  test_add_path ("c", sn_pixmap_accumulate_c);
+#ifdef __SSE2__
+  test_add_path ("sse2", sn_pixmap_accumulate_sse2);
+#endif
+#ifdef SN_PIXMAP_AVX2
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    test_add_path ("avx2", sn_pixmap_accumulate_avx2);
+#endif
+
+  g_test_add_func ("/pixmap/accumulate", test_accumulate);
+  g_test_add_func ("/pixmap/scale", test_scale);
+  g_test_add_func ("/pixmap/scale-flat", test_scale_flat);
+
+  /* timings only with -m perf */
+  if (g_test_perf ())
+    g_test_add_func ("/pixmap/benchmark", test_benchmark);
+
+  return g_test_run ();
+}
@@ -0,0 +1,150 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+#include "sn-util.c"
+
+
+
+/* a touchpad sends smooth scroll events at 120 Hz, frames come at 60 Hz */
+#define EVENT_INTERVAL  8333
+#define FRAME_INTERVAL  16667
+#define BURST_EVENTS    60
+
+
+
+typedef struct
+{
+  guint                calls;
+  gint                 steps_x;
+  gint                 steps_y;
+}
+Result;
+
+
+
+static void
+test_burst (gdouble  delta_x,
+            gdouble  delta_y,
+            guint    rate,
+            Result  *result)
+{
+  SnScrollQueue queue;
+  gint64        event_time = 0;
+  gint64        frame_time = FRAME_INTERVAL;
+  gint          n = 0;
+  gint          dx, dy;
+
+  sn_scroll_queue_init (&queue);
+  result->calls = 0;
+  result->steps_x = 0;
+  result->steps_y = 0;
+
+  /* events and frames in the order of their time, like SnButton gets them */
+  while (n < BURST_EVENTS || !sn_scroll_queue_is_empty (&queue))
+    {
+      if (n < BURST_EVENTS && event_time < frame_time)
+        {
+          sn_scroll_queue_add (&queue, delta_x, delta_y);
+          event_time += EVENT_INTERVAL;
+          n++;
+          continue;
+        }
+
+      if (sn_scroll_queue_flush (&queue, frame_time, rate, &dx, &dy))
+        {
+          /* sn_item_scroll sends a Scroll call per moving axis */
+          result->calls += (dx != 0) + (dy != 0);
+          result->steps_x += dx;
+          result->steps_y += dy;
+        }
+
+      frame_time += FRAME_INTERVAL;
+    }
+}
+
+
+
+static void
+test_scroll_frame (void)
+{
+  Result result;
+
+  /* two events per frame end up in one call, no step gets lost */
+  test_burst (0, 0.1, 0, &result);
+  g_assert_cmpuint (result.calls, ==, BURST_EVENTS / 2);
+  g_assert_cmpint (result.steps_x, ==, 0);
+  g_assert_cmpint (result.steps_y, ==, BURST_EVENTS);
+
+  /* diagonal scrolling makes a call per axis */
+  test_burst (-1.5, 2.5, 0, &result);
+  g_assert_cmpuint (result.calls, ==, BURST_EVENTS);
+  g_assert_cmpint (result.steps_x, ==, -2 * BURST_EVENTS);
+  g_assert_cmpint (result.steps_y, ==, 3 * BURST_EVENTS);
+}
+
+
+
+static void
+test_scroll_rate (void)
+{
+  Result result;
+
+  /* 10 calls per second: the burst lasts half a second, the first frame
+   * sends at once, then every 100 ms and once more for the rest */
+  test_burst (0, 1, 10, &result);
+  g_assert_cmpuint (result.calls, ==, 6);
+  g_assert_cmpint (result.steps_y, ==, BURST_EVENTS);
+
+  /* a rate above the frame rate changes nothing */
+  test_burst (0, 1, 1000, &result);
+  g_assert_cmpuint (result.calls, ==, BURST_EVENTS / 2);
+  g_assert_cmpint (result.steps_y, ==, BURST_EVENTS);
+}
+
+
+
+static void
+test_scroll_cancel (void)
+{
+  SnScrollQueue queue;
+  gint          dx, dy;
+
+  /* steps in opposite directions within a frame send nothing */
+  sn_scroll_queue_init (&queue);
+  sn_scroll_queue_add (&queue, 0, 1);
+  sn_scroll_queue_add (&queue, 0, -1);
+  g_assert_true (sn_scroll_queue_is_empty (&queue));
+  g_assert_false (sn_scroll_queue_flush (&queue, 0, 0, &dx, &dy));
+}
+
+
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/scroll/frame", test_scroll_frame);
+  g_test_add_func ("/scroll/rate", test_scroll_rate);
+  g_test_add_func ("/scroll/cancel", test_scroll_cancel);
+
+  return g_test_run ();
+}
@@ -0,0 +1,345 @@
+/*
+ *  Copyright (c) 2017 Viktor Odintsev <ninetls@xfce.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+
+#include <stdlib.h>
+
+#include "sn-util.c"
+
+
+
+/* the same values as in sn-backend.c */
+#define UPDATE_DELAY   (10 * G_TIME_SPAN_MILLISECOND)
+#define UPDATE_WINDOW  (5 * G_TIME_SPAN_MILLISECOND)
+
+/* a change makes an item send a few New* signals in a row */
+#define BURST_SIGNALS  3
+#define BURST_SPACING  300
+
+
+
+typedef struct
+{
+  gint64               time;
+  gpointer             item;
+}
+Signal;
+
+/* the backend update timer on a simulated clock */
+typedef struct
+{
+  SnDeadlineQueue      queue;
+  gint64               now;
+  gint64               timer;
+  guint                wakeups;
+  guint                updates;
+}
+Sim;
+
+
+
+static void
+sim_init (Sim *sim)
+{
+  sn_deadline_queue_init (&sim->queue);
+  sim->now = 0;
+  sim->timer = G_MAXINT64;
+  sim->wakeups = 0;
+  sim->updates = 0;
+}
+
+
+
+static void
+sim_arm (Sim    *sim,
+         gint64  deadline)
+{
+  gint64 delay;
+
+  /* g_timeout_add works in milliseconds, rounded up like the backend does */
+  delay = MAX (deadline - sim->now, 0);
+  sim->timer = sim->now + (delay + G_TIME_SPAN_MILLISECOND - 1)
+                          / G_TIME_SPAN_MILLISECOND * G_TIME_SPAN_MILLISECOND;
+}
+
+
+
+static void
+sim_run (Sim    *sim,
+         gint64  until)
+{
+  gint64 next;
+
+  while (sim->timer <= until)
+    {
+      sim->now = sim->timer;
+      sim->timer = G_MAXINT64;
+
+      while (sn_deadline_queue_pop (&sim->queue, sim->now + UPDATE_WINDOW) != NULL)
+        sim->updates++;
+      sim->wakeups++;
+
+      next = sn_deadline_queue_next (&sim->queue);
+      if (next != G_MAXINT64)
+        sim_arm (sim, next);
+    }
+
+  sim->now = until;
+}
+
+
+
+static void
+sim_invalidate (Sim      *sim,
+                gpointer  item)
+{
+  gint64 deadline;
+
+  deadline = sim->now + UPDATE_DELAY;
+  sn_deadline_queue_set (&sim->queue, item, deadline);
+  if (sim->timer == G_MAXINT64)
+    sim_arm (sim, deadline);
+}
+
+
+
+static gint
+signal_compare (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 time_a = ((const Signal *) a)->time;
+  gint64 time_b = ((const Signal *) b)->time;
+
+  return time_a < time_b ? -1 : time_a > time_b ? 1 : 0;
+}
+
+
+
+static Signal *
+busy_signals_new (GRand  *rand,
+                  guint   n_items,
+                  gint64  duration,
+                  guint  *n_signals,
+                  guint  *n_changes)
+{
+  Signal *signals = NULL;
+  guint   n = 0, allocated = 0;
+  gint64  time, period;
+  guint   i, k;
+
+  *n_changes = 0;
+
+  /* every item changes at its own pace, between 5 times a second
+   * and once in 2 seconds, starting at a random moment */
+  for (i = 0; i < n_items; i++)
+    {
+      period = g_rand_int_range (rand, 200, 2000) * G_TIME_SPAN_MILLISECOND;
+      for (time = g_rand_int_range (rand, 0, (gint) (period / G_TIME_SPAN_MILLISECOND))
+                  * G_TIME_SPAN_MILLISECOND;
+           time < duration; time += period)
+        {
+          for (k = 0; k < BURST_SIGNALS; k++)
+            {
+              if (n == allocated)
+                {
+                  allocated = MAX (allocated * 2, 256);
+                  signals = g_renew (Signal, signals, allocated);
+                }
+              signals[n].time = time + k * BURST_SPACING;
+              signals[n].item = GUINT_TO_POINTER (i + 1);
+              n++;
+            }
+          (*n_changes)++;
+        }
+    }
+
+  qsort (signals, n, sizeof (Signal), signal_compare);
+  *n_signals = n;
+
+  return signals;
+}
+
+
+
+static void
+sim_replay (Sim          *sim,
+            const Signal *signals,
+            guint         n_signals,
+            gint64        duration)
+{
+  guint n;
+
+  for (n = 0; n < n_signals; n++)
+    {
+      sim_run (sim, signals[n].time);
+      sim_invalidate (sim, signals[n].item);
+    }
+
+  sim_run (sim, duration + UPDATE_DELAY + UPDATE_WINDOW);
+}
+
+
+
+static void
+test_update_idle (void)
+{
+  Sim sim;
+
+  /* nothing changes, the timer is never armed */
+  sim_init (&sim);
+  sim_run (&sim, 60 * G_USEC_PER_SEC);
+  g_assert_cmpuint (sim.wakeups, ==, 0);
+  g_assert_cmpint (sn_deadline_queue_next (&sim.queue), ==, G_MAXINT64);
+  sn_deadline_queue_clear (&sim.queue);
+}
+
+
+
+static void
+test_update_burst (void)
+{
+  Sim   sim;
+  guint i;
+
+  /* items changing within a couple of milliseconds share a wakeup */
+  sim_init (&sim);
+  for (i = 0; i < 50; i++)
+    {
+      sim_run (&sim, i * 40);
+      sim_invalidate (&sim, GUINT_TO_POINTER (i + 1));
+    }
+  sim_run (&sim, G_USEC_PER_SEC);
+  g_assert_cmpuint (sim.wakeups, ==, 1);
+  g_assert_cmpuint (sim.updates, ==, 50);
+
+  /* a burst of signals from one item makes one update */
+  for (i = 0; i < 10; i++)
+    {
+      sim_run (&sim, G_USEC_PER_SEC + i * BURST_SPACING);
+      sim_invalidate (&sim, GUINT_TO_POINTER (1));
+    }
+  sim_run (&sim, 2 * G_USEC_PER_SEC);
+  g_assert_cmpuint (sim.wakeups, ==, 2);
+  g_assert_cmpuint (sim.updates, ==, 51);
+
+  sn_deadline_queue_clear (&sim.queue);
+}
+
+
+
+static void
+test_update_order (void)
+{
+  SnDeadlineQueue queue;
+
+  /* deadlines come out in order, a moved item leaves its old place */
+  sn_deadline_queue_init (&queue);
+  sn_deadline_queue_set (&queue, GUINT_TO_POINTER (1), 30);
+  sn_deadline_queue_set (&queue, GUINT_TO_POINTER (2), 10);
+  sn_deadline_queue_set (&queue, GUINT_TO_POINTER (3), 20);
+  sn_deadline_queue_set (&queue, GUINT_TO_POINTER (2), 40);
+  sn_deadline_queue_remove (&queue, GUINT_TO_POINTER (3));
+
+  g_assert_cmpint (sn_deadline_queue_next (&queue), ==, 30);
+  g_assert_null (sn_deadline_queue_pop (&queue, 29));
+  g_assert_true (sn_deadline_queue_pop (&queue, 40) == GUINT_TO_POINTER (1));
+  g_assert_true (sn_deadline_queue_pop (&queue, 40) == GUINT_TO_POINTER (2));
+  g_assert_null (sn_deadline_queue_pop (&queue, G_MAXINT64));
+
+  sn_deadline_queue_clear (&queue);
+}
+
+
+
+static void
+test_update_busy (void)
+{
+  GRand  *rand;
+  Signal *signals;
+  Sim     sim;
+  guint   n_signals, n_changes;
+
+  rand = g_rand_new_with_seed (1);
+  signals = busy_signals_new (rand, 50, 10 * G_USEC_PER_SEC, &n_signals, &n_changes);
+
+  /* every change is one update, no matter how many signals it sent */
+  sim_init (&sim);
+  sim_replay (&sim, signals, n_signals, 10 * G_USEC_PER_SEC);
+  g_assert_cmpuint (sim.updates, ==, n_changes);
+  g_assert_cmpuint (sim.wakeups, <=, sim.updates);
+  sn_deadline_queue_clear (&sim.queue);
+
+  g_free (signals);
+  g_rand_free (rand);
+}
+
+
+
+static void
+test_benchmark (void)
+{
+  static const guint n_items[] = { 0, 10, 50, 200, 1000 };
+  GRand             *rand;
+  Signal            *signals;
+  Sim                sim;
+  guint              n_signals, n_changes, i;
+  gdouble            elapsed;
+
+  rand = g_rand_new_with_seed (2);
+
+  /* 60 simulated seconds, 0 items is the idle tray */
+  for (i = 0; i < G_N_ELEMENTS (n_items); i++)
+    {
+      signals = busy_signals_new (rand, n_items[i], 60 * G_USEC_PER_SEC, &n_signals, &n_changes);
+
+      sim_init (&sim);
+      g_test_timer_start ();
+      sim_replay (&sim, signals, n_signals, 60 * G_USEC_PER_SEC);
+      elapsed = g_test_timer_elapsed ();
+
+      g_test_message ("%4u items: %6u signals, %5u updates, %5u wakeups (%5.1f/s), %6.2f us per signal",
+                      n_items[i], n_signals, sim.updates, sim.wakeups, sim.wakeups / 60.0,
+                      n_signals > 0 ? elapsed * 1e6 / n_signals : 0.0);
+
+      sn_deadline_queue_clear (&sim.queue);
+      g_free (signals);
+    }
+
+  g_rand_free (rand);
+}
+
+
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/update/idle", test_update_idle);
+  g_test_add_func ("/update/burst", test_update_burst);
+  g_test_add_func ("/update/order", test_update_order);
+  g_test_add_func ("/update/busy", test_update_busy);
+
+  /* timings only with -m perf */
+  if (g_test_perf ())
+    g_test_add_func ("/update/benchmark", test_benchmark);
+
+  return g_test_run ();
+}